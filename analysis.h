@@ -0,0 +1,233 @@
+/*
+ * Operation counters enabled with -D ANALYSIS_OPS.
+ *
+ * "rtry" the number of retries in the __list_find function.
+ * "cons" the number of wait-free contains in the __list_find function that curr
+ * pointer pointed.
+ * "trav" the number of list element traversal in the __list_find function.
+ * "fail" the number of CAS() failures.
+ * "del" the number of list_delete operation failed and restart again.
+ * "ins" the number of list_insert operation failed and restart again.
+ * "deletes" the number of list nodes freed.
+ * "inserts" the number of list nodes allocated.
+ *
+ * Every thread counts into its own cache-line aligned record, so the
+ * counters do not add contention of their own. The records are only
+ * summed up by analysis_func(), once the threads have been joined.
+ */
+
+#ifndef __ANALYSIS_H__
+#define __ANALYSIS_H__
+
+#ifdef ANALYSIS_OPS
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+enum {
+    ST_RTRY,
+    ST_CONS,
+    ST_TRAV,
+    ST_FAIL,
+    ST_DEL,
+    ST_INS,
+    ST_DELETES,
+    ST_INSERTS,
+    ST_NR_OPS, /* the counters above are printed by analysis_func() */
+    ST_HP_SCANS = ST_NR_OPS,
+    ST_HP_RETIRES,
+    ST_HP_THRES,
+    ST_HP_STALLS,
+    ST_BACKOFFS,
+    ST_BACKOFF_NS,
+    ST_NR,
+};
+
+typedef struct analysis {
+    alignas(128) atomic_uint_fast64_t cnt[ST_NR];
+    const char *role;
+    struct analysis *next;
+} analysis_t;
+
+static _Atomic(analysis_t *) analysis_head = NULL;
+static thread_local analysis_t *analysis_v = NULL;
+
+static inline analysis_t *__analysis(void)
+{
+    if (!analysis_v) {
+        analysis_t *a = aligned_alloc(128, sizeof(*a));
+        assert(a);
+        memset(a, 0, sizeof(*a));
+        a->role = "main";
+        a->next = atomic_load(&analysis_head);
+        while (!atomic_compare_exchange_weak(&analysis_head, &a->next, a))
+            ;
+        analysis_v = a;
+    }
+    return analysis_v;
+}
+
+/* Only the owner thread writes its record, a plain load and store is
+ * enough and avoids the locked read-modify-write.
+ */
+#define analysis_add(c, n)                                                     \
+    do {                                                                       \
+        atomic_uint_fast64_t *__c = &__analysis()->cnt[c];                     \
+        atomic_store_explicit(                                                 \
+            __c, atomic_load_explicit(__c, memory_order_relaxed) + (n),        \
+            memory_order_relaxed);                                             \
+    } while (0)
+
+/* Name the calling thread in the per-thread breakdown. */
+#define analysis_role(name)                                                    \
+    do {                                                                       \
+        __analysis()->role = (name);                                           \
+    } while (0)
+
+static inline uint64_t analysis_sum(int c)
+{
+    uint64_t sum = 0;
+    for (analysis_t *a = atomic_load(&analysis_head); a; a = a->next)
+        sum += atomic_load_explicit(&a->cnt[c], memory_order_relaxed);
+    return sum;
+}
+
+#define goto_try_again                                                         \
+    do {                                                                       \
+        analysis_add(ST_RTRY, 1);                                              \
+        goto try_again;                                                        \
+    } while (0)
+#define cons_inc                                                               \
+    do {                                                                       \
+        analysis_add(ST_CONS, 1);                                              \
+    } while (0)
+#define trav_inc                                                               \
+    do {                                                                       \
+        analysis_add(ST_TRAV, 1);                                              \
+    } while (0)
+#define CAS(obj, expected, desired)                                          \
+    ({                                                                       \
+        bool __ret = atomic_compare_exchange_strong(obj, expected, desired); \
+        if (!__ret)                                                          \
+            analysis_add(ST_FAIL, 1);                                        \
+        __ret;                                                               \
+    })
+#define del_inc                                                                \
+    do {                                                                       \
+        analysis_add(ST_DEL, 1);                                               \
+    } while (0)
+#define ins_inc                                                                \
+    do {                                                                       \
+        analysis_add(ST_INS, 1);                                               \
+    } while (0)
+#define deletes_inc                                                            \
+    do {                                                                       \
+        analysis_add(ST_DELETES, 1);                                           \
+    } while (0)
+#define inserts_inc                                                            \
+    do {                                                                       \
+        analysis_add(ST_INSERTS, 1);                                           \
+    } while (0)
+
+static const char *analysis_name[ST_NR_OPS] = {
+    "rtry", "cons", "trav", "fail", "del", "ins", "deletes", "inserts",
+};
+
+static inline void __analysis_header(const char *first)
+{
+    printf("%-8s", first);
+    for (int i = 0; i < ST_NR_OPS; i++)
+        printf(" %10s", analysis_name[i]);
+    printf("\n");
+    for (int i = 0; i < 8 + 11 * ST_NR_OPS; i++)
+        printf("-");
+    printf("\n");
+}
+
+/* Print the average and the maximum per thread of every role, which shows
+ * the imbalance between inserter and deleter threads.
+ */
+static inline void analysis_breakdown(void)
+{
+    const char *roles[16];
+    int nroles = 0;
+
+    for (analysis_t *a = atomic_load(&analysis_head); a; a = a->next) {
+        int i;
+        for (i = 0; i < nroles; i++)
+            if (!strcmp(roles[i], a->role))
+                break;
+        if (i == nroles && nroles < 16)
+            roles[nroles++] = a->role;
+    }
+
+    __analysis_header("per thr");
+    for (int r = 0; r < nroles; r++) {
+        uint64_t sum[ST_NR_OPS] = { 0 }, max[ST_NR_OPS] = { 0 };
+        int nthreads = 0;
+        for (analysis_t *a = atomic_load(&analysis_head); a; a = a->next) {
+            if (strcmp(roles[r], a->role))
+                continue;
+            nthreads++;
+            for (int i = 0; i < ST_NR_OPS; i++) {
+                uint64_t v = atomic_load_explicit(&a->cnt[i],
+                                                  memory_order_relaxed);
+                sum[i] += v;
+                if (v > max[i])
+                    max[i] = v;
+            }
+        }
+        printf("%-8.8s", roles[r]);
+        for (int i = 0; i < ST_NR_OPS; i++)
+            printf(" %10" PRIu64, sum[i] / nthreads);
+        printf("  avg of %d\n%-8s", nthreads, "");
+        for (int i = 0; i < ST_NR_OPS; i++)
+            printf(" %10" PRIu64, max[i]);
+        printf("  max\n");
+    }
+}
+
+#else
+
+#define analysis_add(c, n)                                                     \
+    do {                                                                       \
+    } while (0)
+#define analysis_role(name)                                                    \
+    do {                                                                       \
+    } while (0)
+
+#define goto_try_again                                                         \
+    do {                                                                       \
+        goto try_again;                                                        \
+    } while (0)
+#define cons_inc                                                               \
+    do {                                                                       \
+    } while (0)
+#define trav_inc                                                               \
+    do {                                                                       \
+    } while (0)
+#define CAS(obj, expected, desired)                                            \
+    ({ atomic_compare_exchange_strong(obj, expected, desired); })
+#define del_inc                                                                \
+    do {                                                                       \
+    } while (0)
+#define ins_inc                                                                \
+    do {                                                                       \
+    } while (0)
+#define deletes_inc                                                            \
+    do {                                                                       \
+    } while (0)
+#define inserts_inc                                                            \
+    do {                                                                       \
+    } while (0)
+
+#endif
+
+#endif /* __ANALYSIS_H__ */
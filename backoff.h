@@ -0,0 +1,161 @@
+/*
+ * Contention manager for the CAS failure paths of the lists.
+ *
+ * BACKOFF_NONE retries at once, as the lists always did.
+ * BACKOFF_EXP spins for a random number of pauses below a bound that
+ * starts at 'min' and doubles on every failure of the operation, up to
+ * 'max'. The randomness keeps threads that failed on the same line from
+ * coming back in lockstep.
+ * BACKOFF_PAUSE spins for 'min' pauses on every failure.
+ * Either only starts at the BACKOFF_AFTER-th failure of the operation, a
+ * CAS that lost a single race retries at once.
+ *
+ * The policy is set per list. BACKOFF=none, exp[:min:max] or pause[:n] in
+ * the environment sets the one lists start with, to compare them. With
+ * ANALYSIS_OPS the number of backoffs and the time spent in them are
+ * counted.
+ */
+
+#ifndef __BACKOFF_H__
+#define __BACKOFF_H__
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+
+#include "analysis.h"
+
+#define BACKOFF_NONE 0
+#define BACKOFF_EXP 1
+#define BACKOFF_PAUSE 2
+
+#define BACKOFF_MIN 16 /* pauses */
+#define BACKOFF_MAX 4096
+#define BACKOFF_AFTER 3 /* failures of an operation before it backs off */
+
+typedef struct {
+    int policy;
+    unsigned min, max;
+} backoff_conf_t;
+
+/* State of one operation, from its first CAS failure to its completion */
+typedef struct {
+    const backoff_conf_t *conf;
+    unsigned bound;
+    unsigned fails; /* CAS failures of the operation so far */
+} backoff_t;
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield" ::: "memory");
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+/* The policy of the BACKOFF environment variable, BACKOFF_NONE without */
+static inline backoff_conf_t backoff_conf_env(void)
+{
+    backoff_conf_t conf = { BACKOFF_NONE, BACKOFF_MIN, BACKOFF_MAX };
+    const char *env = getenv("BACKOFF");
+
+    if (!env || !strcmp(env, "none"))
+        return conf;
+    if (!strncmp(env, "exp", 3)) {
+        conf.policy = BACKOFF_EXP;
+        (void)sscanf(env + 3, ":%u:%u", &conf.min, &conf.max);
+    } else if (!strncmp(env, "pause", 5)) {
+        conf.policy = BACKOFF_PAUSE;
+        (void)sscanf(env + 5, ":%u", &conf.min);
+    } else {
+        fprintf(stderr, "BACKOFF=%s: expected none, exp[:min:max] or "
+                        "pause[:n]\n",
+                env);
+        exit(1);
+    }
+    if (conf.min < 1)
+        conf.min = 1;
+    if (conf.max < conf.min)
+        conf.max = conf.min;
+    return conf;
+}
+
+static inline const char *backoff_name(const backoff_conf_t *conf)
+{
+    static const char *names[] = { "none", "exp", "pause" };
+    return names[conf->policy];
+}
+
+static inline void backoff_init(backoff_t *b, const backoff_conf_t *conf)
+{
+    b->conf = conf;
+    b->bound = conf->min;
+    b->fails = 0;
+}
+
+static thread_local uint64_t backoff_seed = 0;
+
+/* Called after a failed CAS, before the operation retries */
+static inline void backoff(backoff_t *b)
+{
+    const backoff_conf_t *conf = b->conf;
+    unsigned spins;
+
+    if (conf->policy == BACKOFF_NONE || ++b->fails < BACKOFF_AFTER)
+        return;
+    if (conf->policy == BACKOFF_PAUSE) {
+        spins = conf->min;
+    } else {
+        if (!backoff_seed)
+            backoff_seed = (uintptr_t)&backoff_seed | 1;
+        // xorshift64
+        backoff_seed ^= backoff_seed << 13;
+        backoff_seed ^= backoff_seed >> 7;
+        backoff_seed ^= backoff_seed << 17;
+        spins = 1 + backoff_seed % b->bound;
+        if (b->bound < conf->max)
+            b->bound = b->bound * 2 < conf->max ? b->bound * 2 : conf->max;
+    }
+
+#ifdef ANALYSIS_OPS
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+#endif
+    for (unsigned i = 0; i < spins; i++)
+        cpu_relax();
+#ifdef ANALYSIS_OPS
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    analysis_add(ST_BACKOFFS, 1);
+    analysis_add(ST_BACKOFF_NS, (end.tv_sec - start.tv_sec) * 1000000000 +
+                                    (end.tv_nsec - start.tv_nsec));
+#endif
+}
+
+#ifdef ANALYSIS_OPS
+
+/*
+ * "backoffs" the number of times a CAS failure backed off.
+ * "ms" the time spent backing off, summed over the threads.
+ * "avg ns" the average time of a backoff.
+ */
+static inline void backoff_analysis(const backoff_conf_t *conf)
+{
+    uint64_t n = analysis_sum(ST_BACKOFFS);
+    uint64_t ns = analysis_sum(ST_BACKOFF_NS);
+    printf("%10s %10s %10s %10s\n", "backoff", "backoffs", "ms", "avg ns");
+    for (int i = 0; i < 43; i++)
+        printf("-");
+    printf("\n%10s %10" PRIu64 " %10.1f %10.1f\n", backoff_name(conf), n,
+           ns / 1e6, n ? (double)ns / n : 0.0);
+}
+
+#endif
+
+#endif /* __BACKOFF_H__ */
@@ -0,0 +1,375 @@
+/*
+ * Throughput benchmark driver shared by the list variants.
+ *
+ * A variant defines the operations below and then includes this file:
+ *
+ *   bench_list_t              the list type
+ *   bench_new()               create a list
+ *   bench_destroy(list)       destroy it
+ *   bench_insert(list, key)   returns true if key was inserted
+ *   bench_delete(list, key)   returns true if key was deleted
+ *   bench_contains(list, key) optional, returns true if key is present
+ *   bench_thread_init(list)   optional, called by every thread before it
+ *   bench_thread_fini(list)   uses the list, and once it is done with it
+ *   bench_report(list)        optional, prints more about the run once the
+ *                             threads have been joined
+ *
+ * Keys are drawn from [1, range] so they never collide with the head and
+ * tail sentinels.
+ */
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <assert.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#ifndef bench_thread_init
+#define bench_thread_init(list) ((void)(list))
+#endif
+#ifndef bench_thread_fini
+#define bench_thread_fini(list) ((void)(list))
+#endif
+
+#define time_diff(start, end)                                                  \
+    ((double)((end).tv_sec - (start).tv_sec) * 1e9 +                           \
+     ((end).tv_nsec - (start).tv_nsec))
+
+typedef struct {
+    int threads;
+    uint64_t range, fill;
+    int insert, delete, lookup; /* percentage of each operation */
+    double theta; /* zipfian skew, 0 is uniform */
+    uint64_t window; /* a key is the last one plus [0, window), 0 to not */
+    double duration; /* in seconds */
+} bench_conf_t;
+
+/* xorshift64* */
+static inline uint64_t bench_rand(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static inline double bench_rand_double(uint64_t *state)
+{
+    return (bench_rand(state) >> 11) * 0x1.0p-53;
+}
+
+/* Zipfian generator of "Quickly Generating Billion-Record Synthetic
+ * Databases" (Gray et al.), as used by YCSB. Rank 0 is the hottest key.
+ */
+typedef struct {
+    uint64_t n;
+    double theta, alpha, zetan, eta;
+} bench_zipf_t;
+
+static void bench_zipf_init(bench_zipf_t *z, uint64_t n, double theta)
+{
+    double zeta2 = 1.0 + pow(0.5, theta);
+
+    z->n = n;
+    z->theta = theta;
+    z->zetan = 0;
+    for (uint64_t i = 1; i <= n; i++)
+        z->zetan += 1.0 / pow((double)i, theta);
+    z->alpha = 1.0 / (1.0 - theta);
+    z->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
+}
+
+static inline uint64_t bench_zipf(const bench_zipf_t *z, uint64_t *state)
+{
+    double u = bench_rand_double(state);
+    double uz = u * z->zetan;
+
+    if (uz < 1.0)
+        return 0;
+    if (uz < 1.0 + pow(0.5, z->theta))
+        return 1;
+    uint64_t rank = z->n * pow(z->eta * u - z->eta + 1.0, z->alpha);
+    return rank < z->n ? rank : z->n - 1;
+}
+
+typedef struct {
+    const bench_conf_t *conf;
+    const bench_zipf_t *zipf;
+    bench_list_t *list;
+    atomic_bool *stop;
+    pthread_barrier_t *barrier;
+    uint64_t seed;
+    uint64_t last; /* the last key, with a window */
+    alignas(128) uint64_t ops;
+} bench_worker_t;
+
+static inline uint64_t bench_key(bench_worker_t *w, uint64_t *state)
+{
+    // each worker walks up the key range, wrapping around at its end
+    if (w->conf->window) {
+        w->last = 1 + (w->last - 1 + bench_rand(state) % w->conf->window) %
+                          w->conf->range;
+        return w->last;
+    }
+    if (w->zipf)
+        return 1 + bench_zipf(w->zipf, state);
+    return 1 + bench_rand(state) % w->conf->range;
+}
+
+static void *bench_worker(void *arg)
+{
+    bench_worker_t *w = arg;
+    const bench_conf_t *conf = w->conf;
+    bench_list_t *list = w->list;
+    uint64_t state = w->seed, ops = 0;
+
+#ifdef analysis_role
+    analysis_role("worker");
+#endif
+    bench_thread_init(list);
+    pthread_barrier_wait(w->barrier);
+
+    while (!atomic_load_explicit(w->stop, memory_order_relaxed)) {
+        uint64_t key = bench_key(w, &state);
+        int op = bench_rand(&state) % 100;
+        if (op < conf->insert)
+            (void)bench_insert(list, key);
+        else if (op < conf->insert + conf->delete)
+            (void)bench_delete(list, key);
+#ifdef bench_contains
+        else
+            (void)bench_contains(list, key);
+#endif
+        ops++;
+    }
+
+    bench_thread_fini(list);
+    w->ops = ops;
+    return NULL;
+}
+
+/* The hardware events counted over the run, per operation */
+enum { BENCH_INSNS, BENCH_CYCLES, BENCH_MISSES, BENCH_NR_EVENTS };
+
+static const uint64_t bench_event_config[BENCH_NR_EVENTS] = {
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_CACHE_MISSES,
+};
+
+/* Count 'config' for this thread and the threads it creates afterwards.
+ * Returns -1 if perf events are not available.
+ */
+static int bench_perf_open(uint64_t config)
+{
+    struct perf_event_attr attr = {
+        .type = PERF_TYPE_HARDWARE,
+        .size = sizeof(attr),
+        .config = config,
+        .disabled = 1,
+        .inherit = 1,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+    };
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void bench_usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-t threads] [-k key range] [-f initial fill]\n"
+            "          [-m insert:delete:lookup] [-z zipf theta] "
+            "[-l window]\n"
+            "          [-s seconds]\n",
+            prog);
+    exit(1);
+}
+
+static void bench_parse(bench_conf_t *conf, int argc, char *argv[])
+{
+    int opt;
+
+    *conf = (bench_conf_t){
+        .threads = 64,
+        .range = 1024,
+        .fill = 512,
+        .insert = 50,
+        .delete = 50,
+        .lookup = 0,
+        .theta = 0,
+        .window = 0,
+        .duration = 1.0,
+    };
+
+    while ((opt = getopt(argc, argv, "t:k:f:m:z:l:s:h")) != -1) {
+        switch (opt) {
+        case 't':
+            conf->threads = atoi(optarg);
+            break;
+        case 'k':
+            conf->range = strtoull(optarg, NULL, 0);
+            break;
+        case 'f':
+            conf->fill = strtoull(optarg, NULL, 0);
+            break;
+        case 'm':
+            if (sscanf(optarg, "%d:%d:%d", &conf->insert, &conf->delete,
+                       &conf->lookup) != 3)
+                bench_usage(argv[0]);
+            break;
+        case 'z':
+            conf->theta = atof(optarg);
+            break;
+        case 'l':
+            conf->window = strtoull(optarg, NULL, 0);
+            break;
+        case 's':
+            conf->duration = atof(optarg);
+            break;
+        default:
+            bench_usage(argv[0]);
+        }
+    }
+
+    if (conf->threads < 1 || conf->range < 2 || conf->fill > conf->range ||
+        conf->insert < 0 || conf->delete < 0 || conf->lookup < 0 ||
+        conf->insert + conf->delete + conf->lookup != 100 ||
+        conf->theta < 0 || conf->theta >= 1 || conf->duration <= 0)
+        bench_usage(argv[0]);
+#ifndef bench_contains
+    if (conf->lookup) {
+        fprintf(stderr, "%s: lookups are not supported\n", argv[0]);
+        exit(1);
+    }
+#endif
+}
+
+static void bench_run(const char *name, const bench_conf_t *conf)
+{
+    bench_list_t *list = bench_new();
+    bench_zipf_t zipf;
+    atomic_bool stop = false;
+    pthread_barrier_t barrier;
+    pthread_t thr[conf->threads];
+    bench_worker_t *w = aligned_alloc(128, conf->threads * sizeof(*w));
+    uint64_t state = 0x9E3779B97F4A7C15ULL, ops = 0;
+    struct timespec start, end;
+
+    assert(w);
+    if (conf->theta > 0)
+        bench_zipf_init(&zipf, conf->range, conf->theta);
+
+    // initial fill
+    bench_thread_init(list);
+    for (uint64_t n = 0; n < conf->fill;)
+        n += bench_insert(list, 1 + bench_rand(&state) % conf->range);
+
+    int perf[BENCH_NR_EVENTS];
+    for (int e = 0; e < BENCH_NR_EVENTS; e++)
+        perf[e] = bench_perf_open(bench_event_config[e]);
+    pthread_barrier_init(&barrier, NULL, conf->threads + 1);
+    for (int i = 0; i < conf->threads; i++) {
+        w[i] = (bench_worker_t){
+            .conf = conf,
+            .zipf = conf->theta > 0 ? &zipf : NULL,
+            .list = list,
+            .stop = &stop,
+            .barrier = &barrier,
+            .seed = bench_rand(&state) | 1,
+            .last = 1 + bench_rand(&state) % conf->range,
+        };
+        pthread_create(&thr[i], NULL, bench_worker, &w[i]);
+    }
+
+    pthread_barrier_wait(&barrier);
+    for (int e = 0; e < BENCH_NR_EVENTS; e++)
+        if (perf[e] >= 0)
+            ioctl(perf[e], PERF_EVENT_IOC_ENABLE, 0);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    struct timespec duration = {
+        .tv_sec = (time_t)conf->duration,
+        .tv_nsec = (conf->duration - (time_t)conf->duration) * 1e9,
+    };
+    nanosleep(&duration, NULL);
+    atomic_store(&stop, true);
+
+    for (int i = 0; i < conf->threads; i++) {
+        pthread_join(thr[i], NULL);
+        ops += w[i].ops;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    uint64_t events[BENCH_NR_EVENTS] = { 0 };
+    for (int e = 0; e < BENCH_NR_EVENTS; e++) {
+        if (perf[e] < 0)
+            continue;
+        ioctl(perf[e], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(perf[e], &events[e], sizeof(events[e])) != sizeof(events[e]))
+            events[e] = 0;
+        close(perf[e]);
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    double secs = time_diff(start, end) / 1e9;
+    printf("## %s: %d threads, keys 1..%" PRIu64 ", fill %" PRIu64
+           ", mix %d:%d:%d, ",
+           name, conf->threads, conf->range, conf->fill, conf->insert,
+           conf->delete, conf->lookup);
+    if (conf->window)
+        printf("window %" PRIu64, conf->window);
+    else if (conf->theta > 0)
+        printf("zipf %.2f", conf->theta);
+    else
+        printf("uniform");
+    printf(", %.2f s\n", conf->duration);
+    printf("%14s %14s %10s %10s %10s %12s\n", "ops", "ops/sec", "insns/op",
+           "cycles/op", "misses/op", "maxrss KB");
+    printf("%14" PRIu64 " %14.1f", ops, ops / secs);
+    for (int e = 0; e < BENCH_NR_EVENTS; e++) {
+        if (events[e] && ops)
+            printf(" %10.2f", (double)events[e] / ops);
+        else
+            printf(" %10s", "n/a");
+    }
+    printf(" %12ld\n", usage.ru_maxrss);
+
+#ifdef bench_report
+    bench_report(list);
+#endif
+
+    pthread_barrier_destroy(&barrier);
+    free(w);
+    bench_thread_fini(list);
+    bench_destroy(list);
+}
+
+static inline int bench_main(const char *name, int argc, char *argv[])
+{
+    bench_conf_t conf;
+
+    bench_parse(&conf, argc, argv);
+    bench_run(name, &conf);
+    return 0;
+}
+
+#endif /* __BENCH_H__ */
@@ -0,0 +1,368 @@
+/*
+ * Split-ordered hash set ("Split-Ordered Lists: Lock-Free Extensible Hash
+ * Tables", Shalev and Shavit) on the ordered list of orderedv2.c.
+ *
+ * All the keys are kept in one ordered list, sorted by their bit-reversed
+ * value. Bucket b points to a sentinel node, whose key is b reversed, in
+ * front of the keys that hash to b, and every operation starts its find
+ * at the sentinel of its bucket. When the table doubles, bucket b + size
+ * is split off bucket b by inserting its sentinel, nothing else moves. So
+ * the table grows without stopping the other threads, and a bucket is only
+ * initialized by the first operation that needs it.
+ *
+ * Keys are hashed by their low bits and have to be below HS_KEY_MAX - 1:
+ * the list key of HS_KEY_MAX - 1 is UINTPTR_MAX, the key of the tail.
+ */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#include "analysis.h"
+#include "latency.h"
+#include "list_hp.h"
+#include "list_node.h"
+#include "pool.h"
+
+#ifdef ANALYSIS_OPS
+
+void analysis_func(void)
+{
+    printf("%10s %10s %10s %10s %10s %10s %10s %10s\n", "rtry", "cons", "trav",
+           "fail", "del", "ins", "deletes", "inserts");
+    for (int i = 0; i < 87; i++)
+        printf("-");
+    printf("\n");
+    for (int i = 0; i < ST_NR_OPS; i++)
+        printf("%10" PRIu64 "%c", analysis_sum(i),
+               i == ST_NR_OPS - 1 ? '\n' : ' ');
+    list_hp_analysis();
+    analysis_breakdown();
+}
+
+#endif
+
+#include <pthread.h>
+
+enum { HP_NEXT = 0, HP_CURR = 1, HP_PREV, HP_START };
+
+#define is_marked(p) (bool)((uintptr_t)(p)&0x01)
+#define get_marked(p) ((uintptr_t)(p) | (0x01))
+#define get_unmarked(p) ((uintptr_t)(p) & (~0x01))
+
+#define get_marked_node(p) ((list_node_t *)get_marked(p))
+#define get_unmarked_node(p) ((list_node_t *)get_unmarked(p))
+
+#include "list_walk.h"
+
+static const list_walk_hps_t list_walk_hps = {
+    .next = HP_NEXT, .curr = HP_CURR, .prev = HP_PREV, .start = HP_START
+};
+
+#define HS_KEY_BITS (sizeof(list_key_t) * 8)
+#define HS_KEY_MAX ((list_key_t)1 << (HS_KEY_BITS - 1))
+
+/* Average number of keys per bucket before the table doubles */
+#define HS_LOAD_FACTOR 2
+
+/* Segment 0 holds bucket 0 and segment s the buckets [2^(s-1), 2^s), so
+ * the table can double up to 2^(HS_SEGMENTS - 1) buckets without moving
+ * the buckets that are there already.
+ */
+#define HS_SEGMENTS 32
+#define HS_MAX_BUCKETS ((uintptr_t)1 << (HS_SEGMENTS - 1))
+
+typedef struct hashset {
+    list_node_t *head, *tail; /* head is the sentinel of bucket 0 */
+    _Atomic(atomic_uintptr_t *) seg[HS_SEGMENTS];
+    atomic_uintptr_t size; /* number of buckets, a power of 2 */
+    alignas(128) atomic_long count;
+    list_hp_t *hp;
+} hashset_t;
+
+/* Nodes of every set, recycled by the thread that frees them */
+static pool_t node_pool = POOL_INIT(sizeof(list_node_t));
+
+list_node_t *list_node_new(list_key_t key)
+{
+    list_node_t *node = pool_alloc(&node_pool);
+    assert(node);
+    *node = (list_node_t){ .key = key };
+    list_node_set_magic(node);
+    inserts_inc;
+    return node;
+}
+
+void list_node_destroy(list_node_t *node)
+{
+    if (!node)
+        return;
+    list_node_check_magic(node);
+    pool_free(&node_pool, node);
+    deletes_inc;
+}
+
+static void __list_node_delete(void *arg)
+{
+    list_node_t *node = (list_node_t *)arg;
+    list_node_destroy(node);
+}
+
+static inline list_key_t __hs_reverse(list_key_t k)
+{
+    k = ((k >> 1) & 0x5555555555555555ULL) | ((k & 0x5555555555555555ULL) << 1);
+    k = ((k >> 2) & 0x3333333333333333ULL) | ((k & 0x3333333333333333ULL) << 2);
+    k = ((k >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((k & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    return __builtin_bswap64(k);
+}
+
+/* The keys of the list: a regular key has its lowest bit set, so it sorts
+ * behind the sentinel of its bucket and never equals a sentinel key.
+ */
+static inline list_key_t so_regular_key(list_key_t key)
+{
+    return __hs_reverse(key | HS_KEY_MAX);
+}
+
+static inline list_key_t so_sentinel_key(uintptr_t bucket)
+{
+    return __hs_reverse(bucket);
+}
+
+/* The find of list_walk.h, from start in the bucket of head */
+static inline bool __list_find_ordered(hashset_t *set, list_key_t *key,
+                                       atomic_uintptr_t *head,
+                                       atomic_uintptr_t *start,
+                                       atomic_uintptr_t **par_prev,
+                                       list_node_t **par_curr,
+                                       list_node_t **par_next)
+{
+    list_hp_thread_t th = list_hp_thread(set->hp);
+    return list_find_ordered(&th, &list_walk_hps, head, set->tail, start,
+                             *key, par_prev, par_curr, par_next);
+}
+
+/* Keep the node of 'prev' protected by HP_START, see list_protect_start() */
+static inline void __hs_protect_start(hashset_t *set, atomic_uintptr_t *head,
+                                      atomic_uintptr_t *prev)
+{
+    list_hp_thread_t th = list_hp_thread(set->hp);
+    list_protect_start(&th, &list_walk_hps, head, prev);
+}
+
+/* Insert key in the list behind head. Returns false, with the node that
+ * holds key in *found, if it is there already.
+ */
+static bool __hs_list_insert(hashset_t *set, atomic_uintptr_t *head,
+                             list_key_t key, list_node_t **found)
+{
+    list_node_t *curr = NULL, *next = NULL;
+    atomic_uintptr_t *prev = head;
+    list_node_t *node = NULL;
+
+    while (true) {
+        if (__list_find_ordered(set, &key, head, prev, &prev, &curr, &next)) {
+            list_node_destroy(node);
+            *found = curr;
+            return false;
+        }
+
+        // only allocate once we know the key is absent
+        if (!node)
+            node = list_node_new(key);
+        atomic_store_explicit(&node->next, (uintptr_t)curr,
+                              memory_order_relaxed);
+        uintptr_t tmp = get_unmarked(curr);
+        if (CAS(prev, &tmp, (uintptr_t)node)) {
+            *found = node;
+            return true;
+        }
+        ins_inc;
+        __hs_protect_start(set, head, prev);
+    }
+}
+
+static atomic_uintptr_t *__hs_slot(hashset_t *set, uintptr_t bucket)
+{
+    int s = bucket ? HS_KEY_BITS - __builtin_clzll(bucket) : 0;
+    uintptr_t base = s ? (uintptr_t)1 << (s - 1) : 0;
+    atomic_uintptr_t *seg = atomic_load(&set->seg[s]);
+
+    if (!seg) {
+        atomic_uintptr_t *new = calloc(base ? base : 1, sizeof(*new));
+        assert(new);
+        if (atomic_compare_exchange_strong(&set->seg[s], &seg, new))
+            seg = new;
+        else
+            free(new);
+    }
+    return &seg[bucket - base];
+}
+
+/* The sentinel of bucket, inserted first if the bucket is not initialized
+ * yet. Its parent, the bucket it is split off, is initialized before it.
+ */
+static list_node_t *__hs_sentinel(hashset_t *set, uintptr_t bucket)
+{
+    atomic_uintptr_t *slot = __hs_slot(set, bucket);
+    list_node_t *sentinel = (list_node_t *)atomic_load(slot);
+
+    if (sentinel)
+        return sentinel;
+
+    uintptr_t parent =
+        bucket & ~((uintptr_t)1 << (HS_KEY_BITS - 1 - __builtin_clzll(bucket)));
+    list_node_t *p = __hs_sentinel(set, parent);
+    // sentinels are never deleted, they stay valid once found
+    (void)__hs_list_insert(set, &p->next, so_sentinel_key(bucket), &sentinel);
+    list_hp_clear(set->hp);
+
+    uintptr_t expected = 0;
+    atomic_compare_exchange_strong(slot, &expected, (uintptr_t)sentinel);
+    return sentinel;
+}
+
+static inline list_node_t *__hs_bucket(hashset_t *set, list_key_t key)
+{
+    uintptr_t size = atomic_load_explicit(&set->size, memory_order_acquire);
+    return __hs_sentinel(set, key & (size - 1));
+}
+
+bool hashset_insert(hashset_t *set, list_key_t key)
+{
+    list_node_t *node;
+    latency_scope(LAT_INSERT);
+
+    assert(key < HS_KEY_MAX - 1);
+    bool inserted = __hs_list_insert(set, &__hs_bucket(set, key)->next,
+                                     so_regular_key(key), &node);
+    list_hp_clear(set->hp);
+    if (!inserted)
+        return false;
+
+    uintptr_t size = atomic_load(&set->size);
+    if (atomic_fetch_add(&set->count, 1) + 1 > (long)(size * HS_LOAD_FACTOR) &&
+        size < HS_MAX_BUCKETS)
+        atomic_compare_exchange_strong(&set->size, &size, size * 2);
+    return true;
+}
+
+bool hashset_delete(hashset_t *set, list_key_t key)
+{
+    list_node_t *curr, *next;
+    atomic_uintptr_t *prev;
+    list_key_t so_key = so_regular_key(key);
+    latency_scope(LAT_DELETE);
+
+    assert(key < HS_KEY_MAX - 1);
+    atomic_uintptr_t *head = &__hs_bucket(set, key)->next;
+    if (!__list_find_ordered(set, &so_key, head, head, &prev, &curr, &next)) {
+        list_hp_clear(set->hp);
+        return false;
+    }
+
+    // marke delete, the thread that sets the mark is the one deleting key
+    uintptr_t tmp = atomic_fetch_or(&curr->next, 0x01);
+    if (is_marked(tmp)) {
+        list_hp_clear(set->hp);
+        return false;
+    }
+    atomic_fetch_sub(&set->count, 1);
+
+    // unlink with the next that was marked, not the one find has seen
+    next = (list_node_t *)tmp;
+    tmp = get_unmarked(curr);
+    if (CAS(prev, &tmp, (uintptr_t)next)) {
+        list_hp_clear(set->hp);
+        list_hp_retire(set->hp, get_unmarked(curr));
+        return true;
+    }
+
+    // prev changed, walk from prev once more, find unlinks curr on its way
+    del_inc;
+    __hs_protect_start(set, head, prev);
+    (void)__list_find_ordered(set, &so_key, head, prev, &prev, &curr, &next);
+    list_hp_clear(set->hp);
+    return true;
+}
+
+/* The lookup of list_walk.h, from the sentinel of the bucket */
+bool hashset_contains(hashset_t *set, list_key_t key)
+{
+    list_hp_thread_t th = list_hp_thread(set->hp);
+    list_key_t so_key = so_regular_key(key);
+    list_node_t *prev;
+    latency_scope(LAT_CONTAINS);
+
+    assert(key < HS_KEY_MAX - 1);
+    list_node_t *head = __hs_bucket(set, key);
+    bool found = list_lookup(&th, &list_walk_hps, head, head, so_key, &prev);
+    list_hpt_clear(&th);
+    return found;
+}
+
+hashset_t *hashset_new(void)
+{
+    hashset_t *set = aligned_alloc(128, sizeof(*set));
+    assert(set);
+    memset(set, 0, sizeof(*set));
+    list_node_t *head = list_node_new(so_sentinel_key(0));
+    list_node_t *tail = list_node_new(UINTPTR_MAX);
+    assert(head), assert(tail);
+
+    atomic_init(&head->next, (uintptr_t)tail);
+    set->head = head;
+    set->tail = tail;
+    atomic_init(&set->size, 2);
+    set->hp = list_hp_new(4, __list_node_delete);
+    list_hp_set_objsize(set->hp, sizeof(list_node_t));
+    atomic_store(__hs_slot(set, 0), (uintptr_t)head);
+    return set;
+}
+
+void hashset_destroy(hashset_t *set)
+{
+    assert(set);
+    list_node_t *prev = set->head;
+    list_node_t *node = get_unmarked_node(atomic_load(&prev->next));
+    while (node) {
+        list_node_destroy(prev);
+        prev = node;
+        node = get_unmarked_node(atomic_load(&prev->next));
+    }
+    list_node_destroy(prev);
+    list_hp_destroy(set->hp);
+    for (int i = 0; i < HS_SEGMENTS; i++)
+        free(atomic_load(&set->seg[i]));
+    free(set);
+}
+
+#define bench_list_t hashset_t
+#define bench_new hashset_new
+#define bench_destroy hashset_destroy
+#define bench_insert hashset_insert
+#define bench_delete hashset_delete
+#define bench_contains hashset_contains
+#define bench_thread_init(set) list_hp_attach((set)->hp)
+#define bench_thread_fini(set) list_hp_detach((set)->hp)
+#define bench_report(set) list_hp_report((set)->hp)
+
+#include "bench.h"
+
+int main(int argc, char *argv[])
+{
+    bench_main("hashset", argc, argv);
+#ifdef ANALYSIS_OPS
+    analysis_func();
+#endif
+#ifdef LATENCY_OPS
+    latency_report();
+#endif
+    return 0;
+}
@@ -0,0 +1,118 @@
+/*
+ * Vector kernels for the hazard scan, used by HP_SCAN_SIMD in list_hp.h.
+ *
+ * hp_simd_find() tells whether 'ptr' is one of the 'n' pointers of 'a',
+ * comparing 8 of them per iteration: one AVX-512 compare, two AVX2 ones
+ * or four NEON ones. 'a' must be padded with zeros up to hp_simd_round(n)
+ * entries, so there is no tail loop; a retired pointer is never null.
+ *
+ * On x86-64 the kernel is picked at startup from what the CPU supports,
+ * so the build needs no -m flag. HP_SIMD=scalar (or avx2, avx512) in the
+ * environment forces a kernel, to compare them.
+ */
+
+#ifndef __HP_SIMD_H__
+#define __HP_SIMD_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HP_SIMD_WIDTH 8 /* pointers compared per iteration */
+
+#define hp_simd_round(n) (((n) + HP_SIMD_WIDTH - 1) & ~(HP_SIMD_WIDTH - 1))
+
+typedef bool(hp_simd_find_t)(const uintptr_t *a, int n, uintptr_t ptr);
+
+static bool __hp_simd_find_scalar(const uintptr_t *a, int n, uintptr_t ptr)
+{
+    for (int i = 0; i < n; i++)
+        if (a[i] == ptr)
+            return true;
+    return false;
+}
+
+#if defined(__x86_64__)
+
+#include <immintrin.h>
+
+__attribute__((target("avx2"))) static bool
+__hp_simd_find_avx2(const uintptr_t *a, int n, uintptr_t ptr)
+{
+    __m256i key = _mm256_set1_epi64x(ptr);
+    for (int i = 0; i < n; i += HP_SIMD_WIDTH) {
+        __m256i lo = _mm256_loadu_si256((const __m256i *)&a[i]);
+        __m256i hi = _mm256_loadu_si256((const __m256i *)&a[i + 4]);
+        __m256i eq = _mm256_or_si256(_mm256_cmpeq_epi64(lo, key),
+                                     _mm256_cmpeq_epi64(hi, key));
+        if (!_mm256_testz_si256(eq, eq))
+            return true;
+    }
+    return false;
+}
+
+__attribute__((target("avx512f"))) static bool
+__hp_simd_find_avx512(const uintptr_t *a, int n, uintptr_t ptr)
+{
+    __m512i key = _mm512_set1_epi64(ptr);
+    for (int i = 0; i < n; i += HP_SIMD_WIDTH) {
+        __m512i v = _mm512_loadu_si512(&a[i]);
+        if (_mm512_cmpeq_epi64_mask(v, key))
+            return true;
+    }
+    return false;
+}
+
+#elif defined(__aarch64__)
+
+#include <arm_neon.h>
+
+static bool __hp_simd_find_neon(const uintptr_t *a, int n, uintptr_t ptr)
+{
+    uint64x2_t key = vdupq_n_u64(ptr);
+    for (int i = 0; i < n; i += HP_SIMD_WIDTH) {
+        const uint64_t *p = (const uint64_t *)&a[i];
+        uint64x2_t eq = vorrq_u64(vorrq_u64(vceqq_u64(vld1q_u64(p), key),
+                                            vceqq_u64(vld1q_u64(p + 2), key)),
+                                  vorrq_u64(vceqq_u64(vld1q_u64(p + 4), key),
+                                            vceqq_u64(vld1q_u64(p + 6), key)));
+        if (vmaxvq_u32(vreinterpretq_u32_u64(eq)))
+            return true;
+    }
+    return false;
+}
+
+#endif
+
+static hp_simd_find_t *hp_simd_find_fn = __hp_simd_find_scalar;
+static const char *hp_simd_name = "scalar";
+
+__attribute__((constructor)) static void __hp_simd_init(void)
+{
+    const char *force = getenv("HP_SIMD");
+
+    if (force && !strcmp(force, "scalar"))
+        return;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") &&
+        (!force || !strcmp(force, "avx512"))) {
+        hp_simd_find_fn = __hp_simd_find_avx512;
+        hp_simd_name = "avx512";
+    } else if (__builtin_cpu_supports("avx2")) {
+        hp_simd_find_fn = __hp_simd_find_avx2;
+        hp_simd_name = "avx2";
+    }
+#elif defined(__aarch64__)
+    hp_simd_find_fn = __hp_simd_find_neon;
+    hp_simd_name = "neon";
+#endif
+}
+
+static inline bool hp_simd_find(const uintptr_t *a, int n, uintptr_t ptr)
+{
+    return hp_simd_find_fn(a, n, ptr);
+}
+
+#endif /* __HP_SIMD_H__ */
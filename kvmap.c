@@ -0,0 +1,105 @@
+/*
+ * The map of kvmap.h with uintptr_t keys and values, the list of list.c
+ * with a value in each node. A value is the key it was inserted with, and
+ * the lookups copy it out.
+ *
+ * KVMAP_HASHED sorts the nodes by a hash of their key first, the path
+ * that is taken by the keys that are slow to compare.
+ */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "analysis.h"
+#include "backoff.h"
+#include "latency.h"
+
+#define KV_NAME kvmap
+#define KV_KEY uintptr_t
+#define KV_VAL uintptr_t
+#ifdef KVMAP_HASHED
+// the splitmix64 finalizer
+static inline uint64_t kvmap_hash(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+#define KV_HASH(k) kvmap_hash(k)
+#endif
+#include "kvmap.h"
+
+static backoff_conf_t kvmap_backoff_conf;
+
+#ifdef ANALYSIS_OPS
+
+void analysis_func(void)
+{
+    printf("%10s %10s %10s %10s %10s %10s %10s %10s\n", "rtry", "cons", "trav",
+           "fail", "del", "ins", "deletes", "inserts");
+    for (int i = 0; i < 87; i++)
+        printf("-");
+    printf("\n");
+    for (int i = 0; i < ST_NR_OPS; i++)
+        printf("%10" PRIu64 "%c", analysis_sum(i),
+               i == ST_NR_OPS - 1 ? '\n' : ' ');
+    list_hp_analysis();
+    backoff_analysis(&kvmap_backoff_conf);
+    analysis_breakdown();
+}
+
+#endif
+
+static kvmap_t *kvmap_bench_new(void)
+{
+    kvmap_t *map = kvmap_new();
+    map->backoff = kvmap_backoff_conf;
+    return map;
+}
+
+static bool kvmap_bench_insert(kvmap_t *map, uintptr_t key)
+{
+    return kvmap_insert(map, key, key);
+}
+
+static bool kvmap_bench_contains(kvmap_t *map, uintptr_t key)
+{
+    uintptr_t val;
+    if (!kvmap_get(map, key, &val))
+        return false;
+    assert(val == key);
+    return true;
+}
+
+#define bench_list_t kvmap_t
+#define bench_new kvmap_bench_new
+#define bench_destroy kvmap_destroy
+#define bench_insert kvmap_bench_insert
+#define bench_delete kvmap_delete
+#define bench_contains kvmap_bench_contains
+#define bench_thread_init(map) list_hp_attach((map)->hp)
+#define bench_thread_fini(map) list_hp_detach((map)->hp)
+#define bench_report(map) list_hp_report((map)->hp)
+
+#include "bench.h"
+
+int main(int argc, char *argv[])
+{
+    kvmap_backoff_conf = backoff_conf_env();
+#ifdef KVMAP_HASHED
+    bench_main("kvmap hashed", argc, argv);
+#else
+    bench_main("kvmap", argc, argv);
+#endif
+#ifdef ANALYSIS_OPS
+    analysis_func();
+#endif
+#ifdef LATENCY_OPS
+    latency_report();
+#endif
+    return 0;
+}
@@ -0,0 +1,518 @@
+/*
+ * Lock-free sorted key/value map, specialized at compile time.
+ *
+ * This is the Harris-Michael list, with the key and value types and their
+ * comparisons given as macros, so every comparison of a walk is inlined
+ * instead of going through a function pointer. list.c is the instance
+ * with uintptr_t keys and no value, kvmap.c the one with uintptr_t values.
+ * Each inclusion defines one map type and its functions, prefixed by
+ * KV_NAME, and undefines the parameters, so the header can be included
+ * again for another type:
+ *
+ *   #define KV_NAME flowmap
+ *   #define KV_KEY flow_key_t
+ *   #define KV_VAL uint32_t
+ *   #define KV_LT(a, b) flow_key_lt(&(a), &(b))
+ *   #define KV_EQ(a, b) flow_key_eq(&(a), &(b))
+ *   #define KV_HASH(k) flow_key_hash(&(k))
+ *   #include "kvmap.h"
+ *
+ * KV_NAME and KV_KEY are required. Without KV_VAL the map is a set of
+ * keys. KV_LT and KV_EQ default to < and ==, so scalar keys need neither.
+ * KV_HASH is optional: with it, the nodes are sorted by the 64-bit hash of
+ * their key first, and KV_LT and KV_EQ are only evaluated on nodes whose
+ * hash matches, which is much cheaper for keys that are slow to compare.
+ *
+ * KV_NODE_T, optional, is a node type of the includer, with a 'next' and
+ * a 'key' field, allocated by KV_NODE_NEW(key) and freed by
+ * KV_NODE_DESTROY(node), which it defines as well. It holds no value and
+ * no hash. It lets list.c keep the layouts of list_node.h.
+ *
+ * The key and the value are stored in the node, and copied in and out by
+ * value. A value is written once, when its node is inserted, there is no
+ * update in place. Types that own memory are not handled, store small
+ * plain values, or pointers whose lifetime the caller manages.
+ *
+ * The end of the map is a NULL next. Sentinel nodes are allowed: a map
+ * whose head links a node below every key, in front of one above every
+ * key, works the same, which is what list.c does.
+ *
+ * It defines:
+ *   KV_NAME_t                 the map
+ *   KV_NAME_domain_new()      a hazard pointer domain for maps of this type
+ *   KV_NAME_new_in_domain(hp) a map whose nodes are retired in 'hp'
+ *   KV_NAME_new()             a map with a domain of its own
+ *   KV_NAME_destroy(map)
+ *   KV_NAME_set_backoff(map, policy, min, max), see backoff.h
+ *   KV_NAME_insert(map, key, val)  false if the key is present
+ *   KV_NAME_get(map, key, &val)    false if absent, 'val' may be NULL
+ *   KV_NAME_delete(map, key)       false if absent
+ * and the _hpt versions of the last three, which take the handle of the
+ * calling thread, see list_hp_thread(). A set has KV_NAME_insert(map, key)
+ * and KV_NAME_contains(map, key) in place of the first two.
+ */
+
+#ifndef __KVMAP_H__
+#define __KVMAP_H__
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "analysis.h"
+#include "backoff.h"
+#include "latency.h"
+#include "list_hp.h"
+#include "pool.h"
+
+enum { KV_HP_NEXT = 0, KV_HP_CURR = 1, KV_HP_PREV, KV_NR_HPS };
+
+#define kv_is_marked(p) (bool)((uintptr_t)(p)&0x01)
+#define kv_get_marked(p) ((uintptr_t)(p) | (0x01))
+#define kv_get_unmarked(p) ((uintptr_t)(p) & (~0x01))
+
+#define __KV_CAT(a, b) a##_##b
+#define __KV_CAT2(a, b) __KV_CAT(a, b)
+
+#endif /* __KVMAP_H__ */
+
+#if !defined(KV_NAME) || !defined(KV_KEY)
+#error "kvmap.h needs KV_NAME and KV_KEY"
+#endif
+#if defined(KV_NODE_T) && (defined(KV_VAL) || defined(KV_HASH))
+#error "a KV_NODE_T node holds no value and no hash"
+#endif
+#ifndef KV_LT
+#define KV_LT(a, b) ((a) < (b))
+#endif
+#ifndef KV_EQ
+#define KV_EQ(a, b) ((a) == (b))
+#endif
+
+#define KV_(x) __KV_CAT2(KV_NAME, x)
+
+// the value argument of the functions, nothing for a set
+#ifdef KV_VAL
+#define KV_VAL_PARAM , KV_VAL val
+#define KV_VAL_ARG , val
+#else
+#define KV_VAL_PARAM
+#define KV_VAL_ARG
+#endif
+
+#ifdef KV_NODE_T
+#define KV_NODE KV_NODE_T
+#else
+#define KV_NODE KV_(node_t)
+
+typedef struct KV_(node) {
+    atomic_uintptr_t next;
+#ifdef KV_HASH
+    uint64_t hash;
+#endif
+    KV_KEY key;
+#ifdef KV_VAL
+    KV_VAL val;
+#endif
+} KV_NODE;
+#endif
+
+typedef struct {
+    atomic_uintptr_t head; /* the first node, NULL when empty */
+    list_hp_t *hp;
+    bool own_hp; /* the domain is destroyed with the map */
+    backoff_conf_t backoff; /* what a failed CAS does before it retries */
+} KV_(t);
+
+/* The key a walk looks for, with its hash */
+typedef struct {
+#ifdef KV_HASH
+    uint64_t hash;
+#endif
+    KV_KEY key;
+} KV_(probe_t);
+
+#ifdef KV_NODE_T
+
+static inline KV_NODE *KV_(node_new)(const KV_(probe_t) *p)
+{
+    KV_NODE *node = KV_NODE_NEW(p->key);
+    assert(node);
+    return node;
+}
+
+static inline void KV_(node_destroy)(KV_NODE *node)
+{
+    KV_NODE_DESTROY(node);
+}
+
+#else
+
+/* Nodes of every map of this type, recycled by the thread that frees them */
+static pool_t KV_(node_pool) = POOL_INIT(sizeof(KV_NODE));
+
+static inline KV_NODE *KV_(node_new)(const KV_(probe_t) *p KV_VAL_PARAM)
+{
+    KV_NODE *node = pool_alloc(&KV_(node_pool));
+    assert(node);
+    atomic_init(&node->next, 0);
+#ifdef KV_HASH
+    node->hash = p->hash;
+#endif
+    node->key = p->key;
+#ifdef KV_VAL
+    node->val = val;
+#endif
+    inserts_inc;
+    return node;
+}
+
+static inline void KV_(node_destroy)(KV_NODE *node)
+{
+    if (!node)
+        return;
+    pool_free(&KV_(node_pool), node);
+    deletes_inc;
+}
+
+#endif
+
+static void KV_(node_delete)(void *arg)
+{
+    KV_(node_destroy)((KV_NODE *)arg);
+}
+
+/* Whether 'node' comes before the key of 'p' in the map */
+static inline bool KV_(before)(const KV_NODE *node, const KV_(probe_t) *p)
+{
+#ifdef KV_HASH
+    if (node->hash != p->hash)
+        return node->hash < p->hash;
+#endif
+    return KV_LT(node->key, p->key);
+}
+
+static inline bool KV_(match)(const KV_NODE *node, const KV_(probe_t) *p)
+{
+#ifdef KV_HASH
+    if (node->hash != p->hash)
+        return false;
+#endif
+    return KV_EQ(node->key, p->key);
+}
+
+/* Find the first node that does not come before the key of 'p', unlinking
+ * the marked nodes on the way. On return *par_prev is the link to it,
+ * *par_curr the node, or NULL at the end of the map, and *par_next its
+ * successor. Returns true if the node holds the key.
+ */
+static bool KV_(find)(KV_(t) *map, const list_hp_thread_t *th,
+                      backoff_t *bo, const KV_(probe_t) *p,
+                      atomic_uintptr_t **par_prev, KV_NODE **par_curr,
+                      KV_NODE **par_next)
+{
+    atomic_uintptr_t *prev;
+    KV_NODE *curr, *next = NULL;
+
+try_again:
+    prev = &map->head;
+    curr = (KV_NODE *)atomic_load(prev);
+    (void)list_hpt_protect_ptr(th, KV_HP_CURR, (uintptr_t)curr);
+    if (atomic_load(prev) != (uintptr_t)curr)
+        goto_try_again;
+
+    while (curr) {
+        next = (KV_NODE *)atomic_load(&curr->next);
+        (void)list_hpt_protect_ptr(th, KV_HP_NEXT, kv_get_unmarked(next));
+        // curr->next changed, or curr was unlinked, under us
+        if (atomic_load(&curr->next) != (uintptr_t)next)
+            goto_try_again;
+        if (atomic_load(prev) != (uintptr_t)curr)
+            goto_try_again;
+
+        if (!kv_is_marked(next)) {
+            if (!KV_(before)(curr, p)) {
+                *par_prev = prev;
+                *par_curr = curr;
+                *par_next = next;
+                return KV_(match)(curr, p);
+            }
+            prev = &curr->next;
+            (void)list_hpt_protect_release(th, KV_HP_PREV, (uintptr_t)curr);
+        } else {
+            // curr is deleted, unlink it before going on
+            cons_inc;
+            uintptr_t tmp = (uintptr_t)curr;
+            if (!CAS(prev, &tmp, kv_get_unmarked(next))) {
+                backoff(bo);
+                goto_try_again;
+            }
+            list_hpt_retire(th, (uintptr_t)curr);
+        }
+        (void)list_hpt_protect_release(th, KV_HP_CURR, kv_get_unmarked(next));
+        curr = (KV_NODE *)kv_get_unmarked(next);
+
+        trav_inc;
+    }
+    *par_prev = prev;
+    *par_curr = NULL;
+    *par_next = NULL;
+    return false;
+}
+
+/* Lookup for the readers, the list_lookup() of list_walk.h on links: it
+ * only moves its own hazard pointers, walks over the marked nodes without
+ * unlinking them, and never backs off. When curr got unlinked under it, it
+ * steps back to prev, the link of the last unmarked node of the walk, and
+ * only starts over from the head when that node was deleted as well.
+ * Returns the node that holds the key of 'p', protected by KV_HP_CURR, or
+ * NULL.
+ */
+static KV_NODE *KV_(lookup)(KV_(t) *map, const list_hp_thread_t *th,
+                            const KV_(probe_t) *p)
+{
+    atomic_uintptr_t *prev = &map->head;
+
+    while (true) {
+        // the node of prev is protected by KV_HP_PREV, or prev is the head
+        uintptr_t c = atomic_load(prev);
+        if (kv_is_marked(c)) {
+            prev = &map->head;
+            continue;
+        }
+        (void)list_hpt_protect_ptr(th, KV_HP_CURR, c);
+        if (atomic_load(prev) != c)
+            continue;
+
+        KV_NODE *curr = (KV_NODE *)c;
+        while (curr) {
+            uintptr_t next = atomic_load(&curr->next);
+            if (!KV_(before)(curr, p)) {
+                // a marked curr was deleted at some point during the walk
+                if (!kv_is_marked(next) && KV_(match)(curr, p))
+                    return curr;
+                return NULL;
+            }
+
+            (void)list_hpt_protect_ptr(th, KV_HP_NEXT, kv_get_unmarked(next));
+            if (atomic_load(&curr->next) != next)
+                continue;
+            if (!kv_is_marked(next)) {
+                (void)list_hpt_protect_release(th, KV_HP_PREV,
+                                               (uintptr_t)curr);
+                prev = &curr->next;
+            } else if (atomic_load(prev) != (uintptr_t)curr) {
+                break;
+            }
+            (void)list_hpt_protect_release(th, KV_HP_CURR,
+                                           kv_get_unmarked(next));
+            curr = (KV_NODE *)kv_get_unmarked(next);
+            trav_inc;
+        }
+        if (!curr)
+            return NULL;
+    }
+}
+
+static inline KV_(probe_t) KV_(probe)(KV_KEY key)
+{
+#ifdef KV_HASH
+    return (KV_(probe_t)){ .hash = KV_HASH(key), .key = key };
+#else
+    return (KV_(probe_t)){ .key = key };
+#endif
+}
+
+static inline bool KV_(insert_hpt)(KV_(t) *map, const list_hp_thread_t *th,
+                                   KV_KEY key KV_VAL_PARAM)
+{
+    KV_(probe_t) p = KV_(probe)(key);
+    KV_NODE *curr, *next, *node = NULL;
+    atomic_uintptr_t *prev;
+    backoff_t bo;
+    latency_scope(LAT_INSERT);
+
+    backoff_init(&bo, &map->backoff);
+    while (true) {
+        if (KV_(find)(map, th, &bo, &p, &prev, &curr, &next)) {
+            KV_(node_destroy)(node);
+            list_hpt_clear(th);
+            return false;
+        }
+
+        // only allocate once we know the key is absent
+        if (!node)
+            node = KV_(node_new)(&p KV_VAL_ARG);
+        atomic_store_explicit(&node->next, (uintptr_t)curr,
+                              memory_order_relaxed);
+        uintptr_t tmp = (uintptr_t)curr;
+        if (CAS(prev, &tmp, (uintptr_t)node)) {
+            list_hpt_clear(th);
+            return true;
+        }
+        ins_inc;
+        backoff(&bo);
+    }
+}
+
+static inline bool KV_(delete_hpt)(KV_(t) *map, const list_hp_thread_t *th,
+                                   KV_KEY key)
+{
+    KV_(probe_t) p = KV_(probe)(key);
+    KV_NODE *curr, *next;
+    atomic_uintptr_t *prev;
+    backoff_t bo;
+    latency_scope(LAT_DELETE);
+
+    backoff_init(&bo, &map->backoff);
+    while (true) {
+        if (!KV_(find)(map, th, &bo, &p, &prev, &curr, &next)) {
+            list_hpt_clear(th);
+            return false;
+        }
+
+        // mark curr deleted, whoever unlinks it retires it
+        uintptr_t tmp = (uintptr_t)next;
+        if (!CAS(&curr->next, &tmp, kv_get_marked(next))) {
+            del_inc;
+            backoff(&bo);
+            continue;
+        }
+
+        tmp = (uintptr_t)curr;
+        if (CAS(prev, &tmp, (uintptr_t)next)) {
+            list_hpt_clear(th);
+            list_hpt_retire(th, (uintptr_t)curr);
+        } else {
+            list_hpt_clear(th);
+        }
+        return true;
+    }
+}
+
+#ifdef KV_VAL
+
+/* The value is copied out while the node is protected */
+static inline bool KV_(get_hpt)(KV_(t) *map, const list_hp_thread_t *th,
+                                KV_KEY key, KV_VAL *val)
+{
+    KV_(probe_t) p = KV_(probe)(key);
+    latency_scope(LAT_CONTAINS);
+
+    KV_NODE *node = KV_(lookup)(map, th, &p);
+    if (node && val)
+        *val = node->val;
+    list_hpt_clear(th);
+    return node;
+}
+
+static inline bool KV_(get)(KV_(t) *map, KV_KEY key, KV_VAL *val)
+{
+    list_hp_thread_t th = list_hp_thread(map->hp);
+    return KV_(get_hpt)(map, &th, key, val);
+}
+
+#else
+
+static inline bool KV_(contains_hpt)(KV_(t) *map, const list_hp_thread_t *th,
+                                     KV_KEY key)
+{
+    KV_(probe_t) p = KV_(probe)(key);
+    latency_scope(LAT_CONTAINS);
+
+    bool found = KV_(lookup)(map, th, &p);
+    list_hpt_clear(th);
+    return found;
+}
+
+static inline bool KV_(contains)(KV_(t) *map, KV_KEY key)
+{
+    list_hp_thread_t th = list_hp_thread(map->hp);
+    return KV_(contains_hpt)(map, &th, key);
+}
+
+#endif
+
+static inline bool KV_(insert)(KV_(t) *map, KV_KEY key KV_VAL_PARAM)
+{
+    list_hp_thread_t th = list_hp_thread(map->hp);
+    return KV_(insert_hpt)(map, &th, key KV_VAL_ARG);
+}
+
+static inline bool KV_(delete)(KV_(t) *map, KV_KEY key)
+{
+    list_hp_thread_t th = list_hp_thread(map->hp);
+    return KV_(delete_hpt)(map, &th, key);
+}
+
+/* Create a domain that any number of maps of this type can share */
+static inline list_hp_t *KV_(domain_new)(void)
+{
+    list_hp_t *hp = list_hp_new(KV_NR_HPS, KV_(node_delete));
+    list_hp_set_objsize(hp, sizeof(KV_NODE));
+    return hp;
+}
+
+/* Create a map whose nodes are protected and retired in 'hp', a domain
+ * from KV_NAME_domain_new(). The domain has to outlive all its maps.
+ */
+static inline KV_(t) *KV_(new_in_domain)(list_hp_t *hp)
+{
+    KV_(t) *map = calloc(1, sizeof(*map));
+    assert(map);
+    *map = (KV_(t)){ .hp = hp,
+                     .backoff = { BACKOFF_NONE, BACKOFF_MIN, BACKOFF_MAX } };
+    atomic_init(&map->head, 0);
+    return map;
+}
+
+static inline KV_(t) *KV_(new)(void)
+{
+    KV_(t) *map = KV_(new_in_domain)(KV_(domain_new)());
+    map->own_hp = true;
+    return map;
+}
+
+static inline void KV_(set_backoff)(KV_(t) *map, int policy, unsigned min,
+                                    unsigned max)
+{
+    map->backoff = (backoff_conf_t){ .policy = policy, .min = min,
+                                     .max = max < min ? min : max };
+}
+
+/* No thread may use the map any more */
+static inline void KV_(destroy)(KV_(t) *map)
+{
+    assert(map);
+    KV_NODE *node = (KV_NODE *)atomic_load(&map->head);
+    while (node) {
+        KV_NODE *next = (KV_NODE *)kv_get_unmarked(atomic_load(&node->next));
+        KV_(node_destroy)(node);
+        node = next;
+    }
+    if (map->own_hp)
+        list_hp_destroy(map->hp);
+    free(map);
+}
+
+#undef KV_VAL_PARAM
+#undef KV_VAL_ARG
+#undef KV_NODE
+#undef KV_
+#undef KV_NAME
+#undef KV_KEY
+#undef KV_LT
+#undef KV_EQ
+#ifdef KV_VAL
+#undef KV_VAL
+#endif
+#ifdef KV_HASH
+#undef KV_HASH
+#endif
+#ifdef KV_NODE_T
+#undef KV_NODE_T
+#undef KV_NODE_NEW
+#undef KV_NODE_DESTROY
+#endif
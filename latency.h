@@ -0,0 +1,187 @@
+/*
+ * Latency histograms enabled with -D LATENCY_OPS.
+ *
+ * "insert" the latency of list_insert (list_insert_conti in orderedv2.c).
+ * "delete" the latency of list_delete (list_delete_once in orderedv2.c).
+ * "contains" the latency of list_contains.
+ * "hp scan" the latency of the hazard scan done by list_hp_retire(), the
+ * delete that triggers it pays for it on top of its own latency.
+ *
+ * Durations are taken with CLOCK_MONOTONIC, in nanoseconds, and counted in
+ * log-linear buckets: 16 buckets per power of two, so a bucket is at most
+ * 1/16 of its value wide. Like the ANALYSIS_OPS counters, every thread has
+ * its own histograms, and latency_report() merges them once the threads
+ * have been joined.
+ */
+
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+enum {
+    LAT_INSERT,
+    LAT_DELETE,
+    LAT_CONTAINS,
+    LAT_HP_SCAN,
+    LAT_NR,
+};
+
+#ifdef LATENCY_OPS
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+
+#define LAT_SUB_BITS 4
+#define LAT_SUB (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS ((64 - LAT_SUB_BITS + 1) * LAT_SUB)
+
+typedef struct latency_hist {
+    uint64_t cnt, max;
+    uint64_t bucket[LAT_BUCKETS];
+} latency_hist_t;
+
+typedef struct latency {
+    alignas(128) latency_hist_t hist[LAT_NR];
+    struct latency *next;
+} latency_t;
+
+static _Atomic(latency_t *) latency_head = NULL;
+static thread_local latency_t *latency_v = NULL;
+
+static inline latency_t *__latency(void)
+{
+    if (!latency_v) {
+        latency_t *l = aligned_alloc(128, sizeof(*l));
+        assert(l);
+        memset(l, 0, sizeof(*l));
+        l->next = atomic_load(&latency_head);
+        while (!atomic_compare_exchange_weak(&latency_head, &l->next, l))
+            ;
+        latency_v = l;
+    }
+    return latency_v;
+}
+
+static inline uint64_t __latency_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline int __latency_bucket(uint64_t ns)
+{
+    if (ns < LAT_SUB)
+        return ns;
+    int msb = 63 - __builtin_clzll(ns);
+    return ((msb - LAT_SUB_BITS + 1) << LAT_SUB_BITS) +
+           ((ns >> (msb - LAT_SUB_BITS)) & (LAT_SUB - 1));
+}
+
+/* The largest value that falls in bucket 'b' */
+static inline uint64_t __latency_bucket_max(int b)
+{
+    if (b < LAT_SUB)
+        return b;
+    int shift = (b >> LAT_SUB_BITS) - 1;
+    uint64_t low = (uint64_t)(LAT_SUB + (b & (LAT_SUB - 1))) << shift;
+    return low + (1ULL << shift) - 1;
+}
+
+static inline void latency_add(int h, uint64_t ns)
+{
+    latency_hist_t *hist = &__latency()->hist[h];
+    hist->cnt++;
+    hist->bucket[__latency_bucket(ns)]++;
+    if (ns > hist->max)
+        hist->max = ns;
+}
+
+typedef struct {
+    int h;
+    uint64_t start;
+} latency_scope_t;
+
+static inline void __latency_scope_end(latency_scope_t *s)
+{
+    latency_add(s->h, __latency_now() - s->start);
+}
+
+/* Time the rest of the enclosing block into histogram 'h', whichever way
+ * the block is left.
+ */
+#define latency_scope(h)                                                       \
+    latency_scope_t __latency_scope                                            \
+        __attribute__((cleanup(__latency_scope_end))) = { (h),                 \
+                                                          __latency_now() }
+
+static const char *latency_name[LAT_NR] = {
+    "insert",
+    "delete",
+    "contains",
+    "hp scan",
+};
+
+static inline uint64_t __latency_percentile(const latency_hist_t *hist,
+                                            double q)
+{
+    uint64_t rank = q * hist->cnt, seen = 0;
+    if (rank < 1)
+        rank = 1;
+    for (int b = 0; b < LAT_BUCKETS; b++) {
+        seen += hist->bucket[b];
+        if (seen >= rank) {
+            uint64_t v = __latency_bucket_max(b);
+            return v < hist->max ? v : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+/* Merge the histograms of all threads and print the tail latencies. */
+static inline void latency_report(void)
+{
+    printf("%-8s %12s %10s %10s %10s %10s\n", "lat (ns)", "count", "p50",
+           "p99", "p99.9", "max");
+    for (int i = 0; i < 8 + 13 + 11 * 4; i++)
+        printf("-");
+    printf("\n");
+    for (int h = 0; h < LAT_NR; h++) {
+        latency_hist_t sum = { 0 };
+        for (latency_t *l = atomic_load(&latency_head); l; l = l->next) {
+            const latency_hist_t *hist = &l->hist[h];
+            sum.cnt += hist->cnt;
+            if (hist->max > sum.max)
+                sum.max = hist->max;
+            for (int b = 0; b < LAT_BUCKETS; b++)
+                sum.bucket[b] += hist->bucket[b];
+        }
+        if (!sum.cnt)
+            continue;
+        printf("%-8s %12" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64
+               " %10" PRIu64 "\n",
+               latency_name[h], sum.cnt, __latency_percentile(&sum, 0.5),
+               __latency_percentile(&sum, 0.99),
+               __latency_percentile(&sum, 0.999), sum.max);
+    }
+}
+
+#else
+
+#define latency_add(h, ns)                                                     \
+    do {                                                                       \
+    } while (0)
+#define latency_scope(h)                                                       \
+    do {                                                                       \
+    } while (0)
+
+#endif
+
+#endif /* __LATENCY_H__ */
@@ -0,0 +1,23 @@
+# Compare the list node layouts of list_node.h against the padded one.
+# usage: bash layout.sh [runs] [bench options]
+
+RUNS=${1:-5}
+[ $# -gt 0 ] && shift
+ARGS=${@:--s 0.5}
+LAYOUTS="PADDED LINE PACKED"
+
+for layout in $LAYOUTS; do
+    printf '#include <stdio.h>\n#include "list_node.h"\nint main(void) { printf("%%zu\\n", sizeof(list_node_t)); return 0; }\n' |
+        gcc -D NDEBUG -D LIST_NODE_LAYOUT=LIST_LAYOUT_$layout -I . -x c -o layout_size -
+    echo "## $layout: $(./layout_size) bytes per node"
+    for src in list ordered orderedv2; do
+        gcc -O2 -D NDEBUG -D LIST_NODE_LAYOUT=LIST_LAYOUT_$layout -Wall \
+            -o layout_bench $src.c -lpthread -lm
+        for i in $(seq $RUNS); do
+            ./layout_bench $ARGS | awk '/ops\/sec/ { getline; print $2 }'
+        done | awk -v src=$src '{ t += $1 } END { printf "%-10s %14.1f ops/sec\n", src, t / NR }'
+    done
+    echo ""
+done
+
+rm -f layout_size layout_bench
@@ -14,57 +14,17 @@
 #include <string.h>
 #include <threads.h>
 
-#ifdef ANALYSIS_OPS
+#include "analysis.h"
+#include "backoff.h"
+#include "latency.h"
+#include "list_hp.h"
+#include "list_node.h"
+#include "pool.h"
 
-/*
- * "rtry" the number of retries in the __list_find function.
- * "cons" the number of wait-free contains in the __list_find function that curr
- * pointer pointed.
- * "trav" the number of list element traversal in the __list_find function.
- * "fail" the number of CAS() failures.
- * "del" the number of list_delete operation failed and restart again.
- * "ins" the number of list_insert operation failed and restart again.
- */
-static atomic_uint_fast64_t rtry = 0, cons = 0, trav = 0, fail = 0;
-static atomic_uint_fast64_t del = 0, ins = 0;
-static atomic_uint_fast64_t deletes = 0, inserts = 0;
-
-#define goto_try_again                                                         \
-    do {                                                                       \
-        atomic_fetch_add(&rtry, 1);                                            \
-        goto try_again;                                                        \
-    } while (0)
-#define cons_inc                                                               \
-    do {                                                                       \
-        atomic_fetch_add(&cons, 1);                                            \
-    } while (0)
-#define trav_inc                                                               \
-    do {                                                                       \
-        atomic_fetch_add(&trav, 1);                                            \
-    } while (0)
-#define CAS(obj, expected, desired)                                          \
-    ({                                                                       \
-        bool __ret = atomic_compare_exchange_strong(obj, expected, desired); \
-        if (!__ret)                                                          \
-            atomic_fetch_add(&fail, 1);                                      \
-        __ret;                                                               \
-    })
-#define del_inc                                                                \
-    do {                                                                       \
-        atomic_fetch_add(&del, 1);                                             \
-    } while (0)
-#define ins_inc                                                                \
-    do {                                                                       \
-        atomic_fetch_add(&ins, 1);                                             \
-    } while (0)
-#define deletes_inc                                                            \
-    do {                                                                       \
-        atomic_fetch_add(&deletes, 1);                                         \
-    } while (0)
-#define inserts_inc                                                            \
-    do {                                                                       \
-        atomic_fetch_add(&inserts, 1);                                         \
-    } while (0)
+/* The policy of the lists created by list_new() and list_new_in_domain() */
+static backoff_conf_t list_backoff_conf;
+
+#ifdef ANALYSIS_OPS
 
 void analysis_func(void)
 {
@@ -72,196 +32,17 @@ void analysis_func(void)
            "fail", "del", "ins", "deletes", "inserts");
     for (int i = 0; i < 87; i++)
         printf("-");
-    printf("\n%10ld %10ld %10ld %10ld %10ld %10ld %10ld %10ld\n", rtry, cons,
-           trav, fail, del, ins, deletes, inserts);
+    printf("\n");
+    for (int i = 0; i < ST_NR_OPS; i++)
+        printf("%10" PRIu64 "%c", analysis_sum(i),
+               i == ST_NR_OPS - 1 ? '\n' : ' ');
+    list_hp_analysis();
+    backoff_analysis(&list_backoff_conf);
+    analysis_breakdown();
 }
 
-#else
-
-#define goto_try_again                                                         \
-    do {                                                                       \
-        goto try_again;                                                        \
-    } while (0)
-#define cons_inc                                                               \
-    do {                                                                       \
-    } while (0)
-#define trav_inc                                                               \
-    do {                                                                       \
-    } while (0)
-#define CAS(obj, expected, desired)                                            \
-    ({ atomic_compare_exchange_strong(obj, expected, desired); })
-#define del_inc                                                                \
-    do {                                                                       \
-    } while (0)
-#define ins_inc                                                                \
-    do {                                                                       \
-    } while (0)
-#define deletes_inc                                                            \
-    do {                                                                       \
-    } while (0)
-#define inserts_inc                                                            \
-    do {                                                                       \
-    } while (0)
-
 #endif
 
-#define HP_MAX_THREADS 128
-#define HP_MAX_HPS 5 /* This is named 'K' in the HP paper */
-#define CLPAD (128 / sizeof(uintptr_t)) /* 128 / 8 = 16 */
-#define HP_THRESHOLD_R 0 /* This is named 'R' in the HP paper */
-
-/* Maximum number of retired objects per thread */
-#define HP_MAX_RETIRED (HP_MAX_THREADS * HP_MAX_HPS)
-
-#define TID_UNKNOWN -1
-
-typedef struct {
-    int size;
-    uintptr_t *list;
-} retirelist_t;
-
-typedef void(list_hp_deletefunc_t)(void *);
-
-typedef struct list_hp {
-    int max_hps;
-    alignas(128) atomic_uintptr_t *hp[HP_MAX_THREADS];
-    alignas(128) retirelist_t *rl[HP_MAX_THREADS * CLPAD];
-    list_hp_deletefunc_t *deletefunc;
-} list_hp_t;
-
-static thread_local int tid_v = TID_UNKNOWN;
-static atomic_int_fast32_t tid_v_base = ATOMIC_VAR_INIT(0);
-
-static inline int tid(void)
-{
-    // atomic_fetch_add return previous value
-    if (tid_v == TID_UNKNOWN) {
-        tid_v = atomic_fetch_add(&tid_v_base, 1);
-        assert(tid_v < HP_MAX_THREADS);
-    }
-    return tid_v;
-}
-
-/* Create a new hazard pointer array of size 'max_hps' (or a reasonable
- * default value if 'max_hps' is 0). The function 'deletefunc' will be
- * used to delete objects protected by hazard pointers when it becomes
- * safe to retire them.
- */
-list_hp_t *list_hp_new(size_t max_hps, list_hp_deletefunc_t *deletefunc)
-{
-    list_hp_t *hp = aligned_alloc(128, sizeof(*hp));
-    assert(hp);
-
-    if (max_hps == 0)
-        max_hps = HP_MAX_HPS;
-
-    *hp = (list_hp_t){ .max_hps = max_hps, .deletefunc = deletefunc };
-
-    for (int i = 0; i < HP_MAX_THREADS; i++) {
-        // sizeof(hp->hp[i][0]) == sizeof(uintptr_t)
-        // nmemb * size = calloc(nmemb, size)
-        // retirelist_t *rl[HP_MAX_THREADS * CLPAD]
-        hp->hp[i] = calloc(CLPAD * 2, sizeof(hp->hp[i][0]));
-        hp->rl[i * CLPAD] = calloc(1, sizeof(*hp->rl[0]));
-        // why bound is max_hps not CLPAD * 2?
-        for (int j = 0; j < hp->max_hps; j++)
-            atomic_init(&hp->hp[i][j], 0);
-        hp->rl[i * CLPAD]->list = calloc(HP_MAX_RETIRED, sizeof(uintptr_t));
-    }
-
-    return hp;
-}
-
-/* Destroy a hazard pointer array and clean up all objects protected
- * by hazard pointers.
- */
-void list_hp_destroy(list_hp_t *hp)
-{
-    for (int i = 0; i < HP_MAX_THREADS; i++) {
-        free(hp->hp[i]);
-        retirelist_t *rl = hp->rl[i * CLPAD];
-        for (int j = 0; j < rl->size; j++) {
-            void *data = (void *)rl->list[j];
-            hp->deletefunc(data);
-        }
-        free(rl->list);
-        free(rl);
-    }
-    free(hp);
-}
-
-/* Clear all hazard pointers in the array for the current thread.
- * Progress condition: wait-free bounded (by max_hps)
- */
-void list_hp_clear(list_hp_t *hp)
-{
-    for (int i = 0; i < hp->max_hps; i++)
-        atomic_store_explicit(&hp->hp[tid()][i], 0, memory_order_release);
-}
-
-/* This returns the same value that is passed as ptr.
- * Progress condition: wait-free population oblivious.
- * ihp can be HP_CURR, HP_NEXT, HP_PREV
- */
-uintptr_t list_hp_protect_ptr(list_hp_t *hp, int ihp, uintptr_t ptr)
-{
-    atomic_store(&hp->hp[tid()][ihp], ptr);
-    return ptr;
-}
-
-/* Same as list_hp_protect_ptr(), but explicitly uses memory_order_release.
- * Progress condition: wait-free population oblivious.
- */
-uintptr_t list_hp_protect_release(list_hp_t *hp, int ihp, uintptr_t ptr)
-{
-    atomic_store_explicit(&hp->hp[tid()][ihp], ptr, memory_order_release);
-    return ptr;
-}
-
-/* Retire an object that is no longer in use by any thread, calling
- * the delete function that was specified in list_hp_new().
- *
- * Progress condition: wait-free bounded (by the number of threads squared)
- */
-void list_hp_retire(list_hp_t *hp, uintptr_t ptr)
-{
-    retirelist_t *rl = hp->rl[tid() * CLPAD];
-    // append the ptr we want to delete
-    rl->list[rl->size++] = ptr;
-    assert(rl->size < HP_MAX_RETIRED);
-
-    if (rl->size < HP_THRESHOLD_R)
-        return;
-
-    for (size_t iret = 0; iret < rl->size; iret++) {
-        uintptr_t obj = rl->list[iret];
-        bool can_delete = true;
-        for (int itid = 0; itid < HP_MAX_THREADS && can_delete; itid++) {
-            for (int ihp = hp->max_hps - 1; ihp >= 0; ihp--) {
-                // if the thread's hp stored the ptr equal to obj
-                // cannot delete.
-                if (atomic_load(&hp->hp[itid][ihp]) == obj) {
-                    // can_delete = false is breaking
-                    // the second  for loop
-                    can_delete = false;
-                    break;
-                }
-            }
-        }
-
-        // when this obj is not in all the hp, delete it.
-        if (can_delete) {
-            //  1  2  3   4   5  6  7  8
-            // [] [] [] iret [] [] [] size
-            // byte = 4
-            size_t bytes = (rl->size - iret) * sizeof(rl->list[0]);
-            memmove(&rl->list[iret], &rl->list[iret + 1], bytes);
-            rl->size--;
-            // RRR;
-            hp->deletefunc((void *)obj);
-        }
-    }
-}
 
 /*
  * The list structure and function
@@ -270,10 +51,6 @@ void list_hp_retire(list_hp_t *hp, uintptr_t ptr)
 
 #include <pthread.h>
 
-#define N_ELEMENTS 128
-#define N_THREADS (64 /*NNN*/)
-#define MAX_THREADS 128
-
 enum { HP_NEXT = 0, HP_CURR = 1, HP_PREV };
 
 #define is_marked(p) (bool)((uintptr_t)(p)&0x01)
@@ -283,28 +60,15 @@ enum { HP_NEXT = 0, HP_CURR = 1, HP_PREV };
 #define get_marked_node(p) ((list_node_t *)get_marked(p))
 #define get_unmarked_node(p) ((list_node_t *)get_unmarked(p))
 
-typedef uintptr_t list_key_t;
-
-typedef struct list_node {
-    alignas(128) uint32_t magic;
-    alignas(128) atomic_uintptr_t next;
-    list_key_t key;
-} list_node_t;
-
-/* Per list variables */
-
-typedef struct list {
-    atomic_uintptr_t head, tail;
-    list_hp_t *hp;
-} list_t;
-
-#define LIST_MAGIC (0xDEADBEAF)
+/* Nodes of every list, recycled by the thread that frees them */
+static pool_t node_pool = POOL_INIT(sizeof(list_node_t));
 
 list_node_t *list_node_new(list_key_t key)
 {
-    list_node_t *node = aligned_alloc(128, sizeof(*node));
+    list_node_t *node = pool_alloc(&node_pool);
     assert(node);
-    *node = (list_node_t){ .magic = LIST_MAGIC, .key = key };
+    *node = (list_node_t){ .key = key };
+    list_node_set_magic(node);
     inserts_inc;
     return node;
 }
@@ -313,278 +77,230 @@ void list_node_destroy(list_node_t *node)
 {
     if (!node)
         return;
-    assert(node->magic == LIST_MAGIC);
-    free(node);
+    list_node_check_magic(node);
+    pool_free(&node_pool, node);
     deletes_inc;
 }
 
-static void __list_node_delete(void *arg)
+/* The list is the set of list_key_t of kvmap.h, on the nodes of
+ * list_node.h. The head links a sentinel node in front of every key, the
+ * first node of the iterator, and a sentinel behind them.
+ */
+#define KV_NAME list_kv
+#define KV_KEY list_key_t
+#define KV_NODE_T list_node_t
+#define KV_NODE_NEW(key) list_node_new(key)
+#define KV_NODE_DESTROY(node) list_node_destroy(node)
+#include "kvmap.h"
+
+typedef list_kv_t list_t;
+
+/* The list operations take the handle 'th' of the calling thread for the
+ * domain of the list, see list_hp_thread(). The ones without it below look
+ * the handle up on every call.
+ */
+bool list_insert_hpt(list_t *list, const list_hp_thread_t *th, list_key_t key)
 {
-    list_node_t *node = (list_node_t *)arg;
-    list_node_destroy(node);
+    return list_kv_insert_hpt(list, th, key);
 }
 
-/*
- * When curr mark delete, curr->next marked. 
- */
-static bool __list_find(list_t *list, list_key_t *key,
-                        atomic_uintptr_t **par_prev, list_node_t **par_curr,
-                        list_node_t **par_next)
+bool list_delete_hpt(list_t *list, const list_hp_thread_t *th, list_key_t key)
 {
-    atomic_uintptr_t *prev = NULL;
-    list_node_t *curr = NULL, *next = NULL;
-
-try_again:
-    prev = &list->head;
-    curr = (list_node_t *)atomic_load(prev);
-    (void)list_hp_protect_ptr(list->hp, HP_CURR, (uintptr_t)curr);
-    if (atomic_load(prev) != get_unmarked(curr))
-        goto_try_again;
+    return list_kv_delete_hpt(list, th, key);
+}
 
-    while (true) {
-#ifdef ANALYSIS_OPS
-        if (is_marked(curr))
-            cons_inc;
-#endif
-        if (!get_unmarked_node(curr))
-            return false;
+/* The read-only lookup of kvmap.h */
+bool list_contains_hpt(list_t *list, const list_hp_thread_t *th, list_key_t key)
+{
+    return list_kv_contains_hpt(list, th, key);
+}
 
-        // next = &list->tail at first
-        // how to let load the value into next
-        // and the protect action does not being interrupt
-        next = (list_node_t *)atomic_load(&get_unmarked_node(curr)->next);
-        (void)list_hp_protect_ptr(list->hp, HP_NEXT, get_unmarked(next));
-
-        //threadA currA->next  =>     nextA      =>
-        //threadB       |prev  => currB(delete)  => nextB
-        //        currA->next  =>                => nextB
-        // currA->next != nextA
-        // insert only use prev curr node, so it is fine.
-        // but curr->next get mark is 0 persent
-        if (atomic_load(&get_unmarked_node(curr)->next) != get_unmarked(next)) {
-            // if (atomic_load(&get_unmarked_node(curr)->next) != (uintptr_t)next) {
-            break;
-        }
+bool list_insert(list_t *list, list_key_t key)
+{
+    list_hp_thread_t th = list_hp_thread(list->hp);
+    return list_insert_hpt(list, &th, key);
+}
 
-        // at the end of list
-        if (get_unmarked(next) == atomic_load((atomic_uintptr_t *)&list->tail))
-            break;
+bool list_delete(list_t *list, list_key_t key)
+{
+    list_hp_thread_t th = list_hp_thread(list->hp);
+    return list_delete_hpt(list, &th, key);
+}
 
-        // one more time to check the prev is same as curr
-        // if during the action the curr is marked, try again.
-        if (atomic_load(prev) != get_unmarked(curr))
-            goto_try_again;
-
-        // next is curr->next value, when curr marked delete
-        // next is marking delete.
-        if (get_unmarked_node(next) == next) {
-            // curr is not marked delete
-            if (!(get_unmarked_node(curr)->key < *key)) {
-                *par_curr = curr;
-                *par_prev = prev;
-                *par_next = next;
-                // return FFF;
-                return get_unmarked_node(curr)->key == *key;
-                // if same then delete function will delete it.
-            }
-
-            // curr->key is smaller than *key
-            // in other word, *key is bigger than curr->key
-            // prev go next
-            // store curr->next pointer into prev
-            prev = &get_unmarked_node(curr)->next;
-            (void)list_hp_protect_release(list->hp, HP_PREV,
-                                          get_unmarked(curr));
-
-        } else {
-            // curr->next (next) is marked delete.
-            // so curr node is deleted.
-            // when prev is curr, put curr into retire list
-            uintptr_t tmp = get_unmarked(curr);
-            // put curr->next value into prev.
-            if (!CAS(prev, &tmp, get_unmarked(next)))
-                goto_try_again;
-            //  try to release curr (marked node)
-            list_hp_retire(list->hp, get_unmarked(curr));
-        }
-        (void)list_hp_protect_release(list->hp, HP_CURR, get_unmarked(next));
-        curr = next;
+bool list_contains(list_t *list, list_key_t key)
+{
+    list_hp_thread_t th = list_hp_thread(list->hp);
+    return list_contains_hpt(list, &th, key);
+}
 
-        trav_inc;
-    }
-    *par_curr = curr;
-    *par_prev = prev;
-    *par_next = next;
+/*
+ * Forward iterator, walking hand-over-hand like list_contains(): curr is
+ * protected by HP_CURR, its successor by HP_NEXT before it is used, and
+ * prev, the last unmarked node of the walk, by HP_PREV. Marked nodes are
+ * skipped, and when a delete unlinks curr under the walk it steps back to
+ * prev instead of starting over. The keys come out in increasing order,
+ * each at most once, and a key that is present for the whole walk is
+ * always one of them.
+ *
+ * The iterator holds the hazard pointers of the calling thread, which may
+ * not use the domain of the list for anything else until list_iter_end().
+ */
+typedef struct {
+    list_t *list;
+    list_hp_thread_t th;
+    list_node_t *head, *prev, *curr;
+    list_key_t last; /* the last key returned */
+} list_iter_t;
 
-    return false;
+void list_iter_begin(list_t *list, list_iter_t *it)
+{
+    list_node_t *head = (list_node_t *)atomic_load(&list->head);
+    *it = (list_iter_t){
+        .list = list,
+        .th = list_hp_thread(list->hp),
+        .head = head,
+        .prev = head,
+        .curr = head,
+    };
 }
 
-bool list_insert(list_t *list, list_key_t key)
+/* Move to the next key of the list. Returns false past the last one. */
+bool list_iter_next(list_iter_t *it, list_key_t *key)
 {
-    list_node_t *curr = NULL, *next = NULL;
-    atomic_uintptr_t *prev = NULL;
-
-    list_node_t *node = list_node_new(key);
+    const list_hp_thread_t *th = &it->th;
+    list_node_t *prev = it->prev, *curr = it->curr;
 
     while (true) {
-        if (__list_find(list, &key, &prev, &curr, &next)) {
-            list_node_destroy(node);
-            list_hp_clear(list->hp);
+        uintptr_t next = atomic_load(&curr->next);
+        // only the tail has no successor
+        if (!get_unmarked(next)) {
+            it->prev = prev, it->curr = curr;
             return false;
         }
 
-        atomic_store_explicit(&node->next, (uintptr_t)curr,
-                              memory_order_relaxed);
-        uintptr_t tmp = get_unmarked(curr);
-        if (CAS(prev, &tmp, (uintptr_t)node)) {
-            list_hp_clear(list->hp);
+        (void)list_hpt_protect_ptr(th, HP_NEXT, get_unmarked(next));
+        if (atomic_load(&curr->next) != next)
+            continue;
+        if (!is_marked(next)) {
+            (void)list_hpt_protect_release(th, HP_PREV, (uintptr_t)curr);
+            prev = curr;
+        } else if (atomic_load(&prev->next) != (uintptr_t)curr) {
+            (void)list_hpt_protect_release(th, HP_CURR, (uintptr_t)prev);
+            curr = prev;
+            prev = it->head;
+            continue;
+        }
+        (void)list_hpt_protect_release(th, HP_CURR, get_unmarked(next));
+        curr = get_unmarked_node(next);
+
+        // After a step back, the walk may pass again over keys it has
+        // returned, or over keys inserted behind it since.
+        uintptr_t succ = atomic_load(&curr->next);
+        if (get_unmarked(succ) && !is_marked(succ) && curr->key > it->last) {
+            it->prev = prev, it->curr = curr;
+            *key = it->last = curr->key;
             return true;
         }
-            ins_inc;
     }
 }
 
-/*
- * delete curr node
- * node->next => curr => next
- *       prev
+void list_iter_end(list_iter_t *it)
+{
+    list_hpt_clear(&it->th);
+}
+
+/* Call 'fn' on every key in [lo, hi] in increasing order, until it returns
+ * false. Writers are not held back, the keys are the ones list_iter_next()
+ * sees. 'fn' may not use the domain of the list. Returns the number of
+ * calls.
  */
-bool list_delete(list_t *list, list_key_t key)
+int list_range(list_t *list, list_key_t lo, list_key_t hi,
+               bool (*fn)(list_key_t key, void *arg), void *arg)
 {
-    list_node_t *curr, *next;
-    atomic_uintptr_t *prev;
-    while (true) {
-        if (!__list_find(list, &key, &prev, &curr, &next)) {
-            list_hp_clear(list->hp);
-            return false;
-        }
+    list_iter_t it;
+    list_key_t key;
+    int n = 0;
 
-        // marke delete
-        uintptr_t tmp = get_unmarked(next);
-        if (!CAS(&curr->next, &tmp, get_marked(next))) {
-            del_inc;
+    list_iter_begin(list, &it);
+    while (list_iter_next(&it, &key) && key <= hi) {
+        if (key < lo)
             continue;
-        }
-
-        tmp = get_unmarked(curr);
-        if (CAS(prev, &tmp, get_unmarked(next))) {
-            list_hp_clear(list->hp);
-            // DDD;
-            list_hp_retire(list->hp, get_unmarked(curr));
-        } else {
-            list_hp_clear(list->hp);
-        }
-        return true;
+        n++;
+        if (!fn(key, arg))
+            break;
     }
+    list_iter_end(&it);
+    return n;
 }
 
-list_t *list_new(void)
+/* Create a domain that any number of lists can share. Its delete function
+ * frees the nodes of all of them.
+ */
+list_hp_t *list_domain_new(void)
 {
-    list_t *list = calloc(1, sizeof(*list));
-    assert(list);
+    return list_kv_domain_new();
+}
+
+/* Create a list whose nodes are protected and retired in 'hp', a domain
+ * from list_domain_new(). The domain is not destroyed with the list, the
+ * nodes the list retired are freed by the domain, so it has to outlive
+ * all its lists.
+ */
+list_t *list_new_in_domain(list_hp_t *hp)
+{
+    list_t *list = list_kv_new_in_domain(hp);
     list_node_t *head = list_node_new(0), *tail = list_node_new(UINTPTR_MAX);
     assert(head), assert(tail);
-    list_hp_t *hp = list_hp_new(3, __list_node_delete);
 
     atomic_init(&head->next, (uintptr_t)tail);
-    *list = (list_t){ .hp = hp };
     atomic_init(&list->head, (uintptr_t)head);
-    atomic_init(&list->tail, (uintptr_t)tail);
+    list->backoff = list_backoff_conf;
 
     return list;
 }
 
-void list_destroy(list_t *list)
+/* Set what the failed CASes of 'list' do before they retry, see backoff.h.
+ * It is read by every operation, set it before the list is shared.
+ */
+void list_set_backoff(list_t *list, int policy, unsigned min, unsigned max)
 {
-    assert(list);
-    list_node_t *prev = (list_node_t *)atomic_load(&list->head);
-    list_node_t *node = (list_node_t *)atomic_load(&prev->next);
-    while (node) {
-        list_node_destroy(prev);
-        prev = node;
-        node = (list_node_t *)atomic_load(&prev->next);
-    }
-    list_node_destroy(prev);
-    list_hp_destroy(list->hp);
-    free(list);
+    list_kv_set_backoff(list, policy, min, max);
 }
 
-static uintptr_t elements[MAX_THREADS + 1][N_ELEMENTS];
-
-static void *insert_thread(void *arg)
+/* Create a list with a domain of its own */
+list_t *list_new(void)
 {
-    list_t *list = (list_t *)arg;
-
-    for (size_t i = 0; i < N_ELEMENTS; i++)
-        (void)list_insert(list, (uintptr_t)&elements[tid()][i]);
-
-    return NULL;
+    list_t *list = list_new_in_domain(list_domain_new());
+    list->own_hp = true;
+    return list;
 }
 
-// odd
-static void *delete_thread(void *arg)
+void list_destroy(list_t *list)
 {
-    list_t *list = (list_t *)arg;
-
-    for (size_t i = 0; i < N_ELEMENTS; i++)
-        (void)list_delete(list, (uintptr_t)&elements[tid()][i]);
-
-    return NULL;
+    list_kv_destroy(list);
 }
 
-#include <time.h>
-
-#define time_diff(start, end)                                                  \
-    (end.tv_nsec - start.tv_nsec < 0 ?                                         \
-             (1000000000 + end.tv_nsec - start.tv_nsec) :                      \
-             (end.tv_nsec - start.tv_nsec))
-#define time_check(_FUNC_)                                                     \
-    do {                                                                       \
-        struct timespec time_start;                                            \
-        struct timespec time_end;                                              \
-        double during;                                                         \
-        clock_gettime(CLOCK_MONOTONIC, &time_start);                           \
-        _FUNC_;                                                                \
-        clock_gettime(CLOCK_MONOTONIC, &time_end);                             \
-        during = time_diff(time_start, time_end);                              \
-        printf("%f\n", during);                                                \
-    } while (0)
-
-static inline int test(void)
-{
-    list_t *list = list_new();
-
-    pthread_t thr[N_THREADS];
-
-    for (size_t i = 0; i < N_THREADS; i++)
-        pthread_create(&thr[i], NULL, (i & 1) ? delete_thread : insert_thread,
-                       list);
+#define bench_list_t list_t
+#define bench_new list_new
+#define bench_destroy list_destroy
+#define bench_insert list_insert
+#define bench_delete list_delete
+#define bench_contains list_contains
+#define bench_thread_init(list) list_hp_attach((list)->hp)
+#define bench_thread_fini(list) list_hp_detach((list)->hp)
+#define bench_report(list) list_hp_report((list)->hp)
 
-    for (size_t i = 0; i < N_THREADS; i++)
-        pthread_join(thr[i], NULL);
+#include "bench.h"
 
-    for (size_t i = 0; i < N_ELEMENTS; i++) {
-        for (size_t j = 0; j < tid_v_base; j++)
-            list_delete(list, (uintptr_t)&elements[j][i]);
-    }
-
-    list_destroy(list);
-
-    return 0;
-}
-
-int main(void)
+int main(int argc, char *argv[])
 {
-    // time_check(test());
+    list_backoff_conf = backoff_conf_env();
+    bench_main("list", argc, argv);
 #ifdef ANALYSIS_OPS
-    int times = 20;
-    for (int i = 0;i < times;i++) {
-        test();
-        tid_v_base = 0;
-    }
     analysis_func();
-#else
-    test();
+#endif
+#ifdef LATENCY_OPS
+    latency_report();
 #endif
     return 0;
 }
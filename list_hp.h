@@ -0,0 +1,1225 @@
+/*
+ * Hazard pointers are a mechanism for protecting objects in memory from
+ * being deleted by other threads while in use. This allows safe lock-free
+ * data structures.
+ *
+ * This is the hazard pointer domain shared by the array-backed list
+ * variants (list.c, ordered.c and orderedv2.c).
+ */
+
+#ifndef __LIST_HP_H__
+#define __LIST_HP_H__
+
+#include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/membarrier.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifdef HP_NUMA
+#include <linux/mempolicy.h>
+#endif
+
+#include "analysis.h"
+#include "latency.h"
+
+#define HP_MAX_THREADS 128
+#define HP_MAX_HPS 5 /* This is named 'K' in the HP paper */
+#define CLPAD (128 / sizeof(uintptr_t)) /* 128 / 8 = 16 */
+
+/* A thread scans its retire list once it holds R = H * (1 + k) objects,
+ * where H is the number of hazard pointers of the registered threads
+ * ('R', 'H' and 'k' in the HP paper). Each scan then frees at least
+ * k * H objects, so the cost of reclamation is amortized per retire.
+ */
+#ifndef HP_THRESHOLD_K
+#define HP_THRESHOLD_K 1
+#endif
+
+/* Initial capacity of a retire list, it grows on demand */
+#define HP_RETIRED_INIT 64
+
+/* Hazard scan used by list_hp_retire().
+ * HP_SCAN_LINEAR compares each retired object against every hazard slot.
+ * HP_SCAN_SORTED takes a snapshot of the non-null hazard pointers, sorts
+ * it and binary searches each retired object in it (Scan() in the HP
+ * paper), which is O((R + H) log H) instead of O(R * T * K).
+ * HP_SCAN_SIMD takes the snapshot without sorting it, and compares each
+ * retired object against 8 hazard pointers at a time with the vector
+ * kernel of hp_simd.h. Up to HP_SIMD_MAX hazard pointers that is 2 to 4
+ * times faster than the sort, above it the snapshot is sorted as with
+ * HP_SCAN_SORTED.
+ *
+ * Every scan reads the slots of a row in increasing order. A walk that
+ * hands a node over from one of its slots to another stores it in the new
+ * slot before the old one is overwritten, so a scan cannot miss the node
+ * as long as the old slot is the lower one: the walks number their slots
+ * that way (HP_CURR before HP_PREV, HP_CURR(i) before HP_PRED(i)).
+ */
+#define HP_SCAN_LINEAR 0
+#define HP_SCAN_SORTED 1
+#define HP_SCAN_SIMD 2
+
+#ifndef HP_SCAN
+#define HP_SCAN HP_SCAN_SIMD
+#endif
+
+#ifndef HP_SIMD_MAX
+#define HP_SIMD_MAX 128
+#endif
+
+#if HP_SCAN == HP_SCAN_SIMD
+#include "hp_simd.h"
+#endif
+
+/* Reclamation backend behind the list_hp_* API.
+ * HP_BACKEND_HAZARD protects every node with a hazard pointer, as above.
+ * HP_BACKEND_EPOCH is epoch-based reclamation: the first protect of an
+ * operation announces the global epoch in the first slot of the thread,
+ * the other protects cost nothing, and list_hp_clear() leaves the epoch.
+ * An object retired in epoch e is freed once the global epoch is e + 2,
+ * every thread has left e by then. A thread that stalls inside an
+ * operation holds the epoch back, and every retired object with it.
+ */
+#define HP_BACKEND_HAZARD 0
+#define HP_BACKEND_EPOCH 1
+
+#ifndef HP_BACKEND
+#define HP_BACKEND HP_BACKEND_HAZARD
+#endif
+
+/* How a hazard pointer is ordered before the validation that follows it.
+ * HP_FENCE_SYMMETRIC publishes it with a sequentially consistent store,
+ * each protect pays for a full fence.
+ * HP_FENCE_ASYMMETRIC publishes it with a release store and a compiler
+ * barrier, and the scan issues membarrier(MEMBARRIER_CMD_PRIVATE_EXPEDITED)
+ * before it reads the hazard slots, which runs a full fence on every CPU
+ * that runs a thread of the process. The fence moves from the traversal
+ * to the scan, which is much rarer. Without membarrier the protects fall
+ * back to the sequentially consistent store.
+ */
+#define HP_FENCE_SYMMETRIC 0
+#define HP_FENCE_ASYMMETRIC 1
+
+#ifndef HP_FENCE
+#define HP_FENCE HP_FENCE_SYMMETRIC
+#endif
+
+/* Who reclaims the retired objects.
+ * HP_RECLAIM_INLINE: the thread that retires an object scans its own
+ * retire list once it reaches the threshold, and frees what it can.
+ * HP_RECLAIM_BACKGROUND: list_hp_retire() only pushes the object into a
+ * ring of the thread, and a reclaimer thread started by list_hp_new()
+ * drains the rings of every thread into one retire list, scans it with a
+ * single hazard snapshot and frees the objects. A thread whose ring is
+ * full waits for the reclaimer to catch up.
+ */
+#define HP_RECLAIM_INLINE 0
+#define HP_RECLAIM_BACKGROUND 1
+
+#ifndef HP_RECLAIM
+#define HP_RECLAIM HP_RECLAIM_INLINE
+#endif
+
+#define HP_RING_SIZE 1024 /* objects a ring holds, a power of two */
+#define HP_RECLAIM_IDLE_NS 50000 /* sleep of the reclaimer when idle */
+
+/* With -D HP_NUMA, a thread gets a home node, the node of the CPU it runs
+ * on when it first attaches. Its hazard slots are a row of the hazard
+ * table of its node, which is bound to that node, so a scan reads the
+ * table of each node in one pass and a protect never writes to a remote
+ * line. Its retire buffers are allocated, and first touched, by the
+ * thread itself. The slabs of pool.h are bound to the node of the thread
+ * that allocates them, and an object freed on another node goes back to
+ * the depot of its own node. The home node is only worth something if
+ * the threads stay on their node, pin them.
+ */
+#ifdef HP_NUMA
+#ifndef HP_NUMA_NODES
+#define HP_NUMA_NODES 8 /* nodes above are folded onto these */
+#endif
+#else
+#define HP_NUMA_NODES 1
+#endif
+
+#define TID_UNKNOWN -1
+
+/* Single producer, single consumer ring of retired objects, from a thread
+ * to the reclaimer.
+ */
+typedef struct {
+    alignas(128) atomic_uint head; /* written by the reclaimer */
+    alignas(128) atomic_uint tail; /* written by the owner thread */
+    uintptr_t buf[HP_RING_SIZE];
+} list_hp_ring_t;
+
+/* The retire list of a thread slot, a list per cache line. It is only
+ * allocated, with its buffers, once a thread with that slot attaches.
+ */
+typedef struct {
+    alignas(128) int size, cap;
+    int pending; /* retired since the last scan */
+    uintptr_t *list;
+    uintptr_t *snap; /* scratch space for the hazard snapshot */
+    uintptr_t *era; /* epoch each object was retired in */
+    list_hp_ring_t *ring; /* hand-off to the reclaimer */
+    /* for list_hp_stats(), only written by the owner, read by anyone */
+    atomic_long st_size, st_peak; /* retired objects not freed yet */
+    atomic_uint_fast64_t st_scans, st_freed, st_scan_ns, st_scan_max_ns;
+} retirelist_t;
+
+/* Retired objects left behind by a thread that detached from the domain,
+ * waiting to be adopted by another thread.
+ */
+typedef struct list_hp_orphan {
+    struct list_hp_orphan *next;
+    int size;
+    uintptr_t list[];
+} list_hp_orphan_t;
+
+typedef void(list_hp_deletefunc_t)(void *);
+
+typedef struct list_hp {
+    int max_hps;
+    atomic_int nthreads; /* number of attached threads */
+    atomic_int hwm; /* high-water mark of the attached thread slots */
+    _Atomic(list_hp_orphan_t *) orphans;
+    atomic_long unreclaimed, peak; /* retired objects not freed yet */
+    atomic_long orphaned; /* objects in the orphan lists */
+    alignas(128) atomic_uintptr_t epoch;
+    int stride; /* slots per thread in the hazard table */
+    size_t objsize; /* bytes of a retired object, for list_hp_stats() */
+    /* a hazard table per node (one without HP_NUMA), mapped when a thread
+     * of it first attaches
+     */
+    _Atomic(atomic_uintptr_t *) node_hps[HP_NUMA_NODES];
+#ifdef HP_NUMA
+    atomic_int node_hwm[HP_NUMA_NODES]; /* the slots of a node's threads */
+#endif
+    /* the retire list of each thread slot, set on its first attach */
+    _Atomic(retirelist_t *) rl[HP_MAX_THREADS];
+    list_hp_deletefunc_t *deletefunc;
+    pthread_t reclaimer;
+    atomic_bool stop; /* tells the reclaimer to drain and exit */
+} list_hp_t;
+
+#ifdef ANALYSIS_OPS
+
+/*
+ * "scans" the number of hazard scans done by list_hp_retire() (or by
+ * the reclaimer).
+ * "retires" the number of objects passed to list_hp_retire().
+ * "avg R" the average scan threshold R.
+ * "stalls" the number of times a retire waited for the reclaimer.
+ */
+static inline void list_hp_analysis(void)
+{
+    uint64_t scans = analysis_sum(ST_HP_SCANS);
+    uint64_t retires = analysis_sum(ST_HP_RETIRES);
+    uint64_t thres = analysis_sum(ST_HP_THRES);
+    uint64_t stalls = analysis_sum(ST_HP_STALLS);
+    printf("%10s %10s %10s %10s %10s\n", "scans", "retires", "avg R",
+           "ret/scan", "stalls");
+    for (int i = 0; i < 54; i++)
+        printf("-");
+    printf("\n%10" PRIu64 " %10" PRIu64 " %10.1f %10.1f %10" PRIu64 "\n",
+           scans, retires, scans ? (double)thres / scans : 0.0,
+           scans ? (double)retires / scans : 0.0, stalls);
+}
+
+#endif
+
+/* Thread slots are shared by all domains. A thread holds its slot while
+ * it is attached to at least one domain, and the slot is reused by the
+ * next thread after it detached from all of them.
+ */
+static atomic_bool tid_slot[HP_MAX_THREADS];
+static thread_local int tid_v = TID_UNKNOWN;
+static thread_local int tid_refs = 0;
+
+#ifdef HP_NUMA
+
+static int tid_node[HP_MAX_THREADS]; /* home node of the slot's thread */
+
+/* The node of the CPU the thread runs on right now */
+static inline int __hp_numa_current(void)
+{
+    unsigned cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+        return 0;
+    return node % HP_NUMA_NODES;
+}
+
+/* Bind [addr, addr + size) to 'node', moving the pages already touched.
+ * It is only a placement hint, a failure leaves the memory where it is.
+ */
+static inline void hp_numa_bind(void *addr, size_t size, int node)
+{
+    unsigned long mask = 1UL << node;
+    (void)syscall(SYS_mbind, addr, size, MPOL_PREFERRED, &mask,
+                  sizeof(mask) * 8, MPOL_MF_MOVE);
+}
+
+#endif
+
+/* The home node of the calling thread, 0 without HP_NUMA */
+static inline int hp_numa_node(void)
+{
+#ifdef HP_NUMA
+    if (tid_v != TID_UNKNOWN)
+        return tid_node[tid_v];
+    return __hp_numa_current();
+#else
+    return 0;
+#endif
+}
+
+static inline int tid(void)
+{
+    assert(tid_v != TID_UNKNOWN && "thread is not attached");
+    return tid_v;
+}
+
+/* Claim the lowest free slot, so the slots in use stay dense. */
+static inline int __tid_acquire(void)
+{
+    for (int i = 0; i < HP_MAX_THREADS; i++) {
+        bool expected = false;
+        if (!atomic_load_explicit(&tid_slot[i], memory_order_relaxed) &&
+            atomic_compare_exchange_strong(&tid_slot[i], &expected, true))
+            return i;
+    }
+    assert(0 && "too many threads");
+    return TID_UNKNOWN;
+}
+
+static inline void __tid_release(int i)
+{
+    atomic_store_explicit(&tid_slot[i], false, memory_order_release);
+}
+
+#if HP_FENCE == HP_FENCE_ASYMMETRIC
+
+/* Whether the process is registered for private expedited membarrier.
+ * list_hp_new() registers it, so it is set before the threads that use
+ * the domain are started.
+ */
+static atomic_bool hp_membarrier = false;
+
+static inline void __hp_membarrier_register(void)
+{
+    static atomic_flag warned = ATOMIC_FLAG_INIT;
+    if (atomic_load(&hp_membarrier))
+        return;
+    if (syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0,
+                0) == 0)
+        atomic_store(&hp_membarrier, true);
+    else if (!atomic_flag_test_and_set(&warned))
+        fprintf(stderr, "membarrier is not available, HP_FENCE_ASYMMETRIC "
+                        "falls back to sequentially consistent stores\n");
+}
+
+#endif
+
+/* Publish a hazard pointer (or an epoch) before the loads that validate it */
+static inline void __hp_publish(atomic_uintptr_t *slot, uintptr_t ptr)
+{
+#if HP_FENCE == HP_FENCE_ASYMMETRIC
+    if (atomic_load_explicit(&hp_membarrier, memory_order_relaxed)) {
+        atomic_store_explicit(slot, ptr, memory_order_release);
+        // the heavy barrier of the scan orders the store on the CPU
+        atomic_signal_fence(memory_order_seq_cst);
+        return;
+    }
+#endif
+    atomic_store(slot, ptr);
+}
+
+/* Pairs with __hp_publish(), called before the hazard slots are read */
+static inline void __hp_heavy_barrier(void)
+{
+#if HP_FENCE == HP_FENCE_ASYMMETRIC
+    if (atomic_load_explicit(&hp_membarrier, memory_order_relaxed)) {
+        int ret =
+            syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+        assert(ret == 0 && "membarrier failed");
+        (void)ret;
+    }
+#endif
+    // otherwise the sequentially consistent stores and loads are enough
+}
+
+/* Bytes of a hazard table, a row of 'stride' slots for every thread slot */
+static inline size_t __hp_table_size(list_hp_t *hp)
+{
+    return HP_MAX_THREADS * hp->stride * sizeof(atomic_uintptr_t);
+}
+
+/* Map the hazard table of 'node' unless another thread did it already.
+ * Only the pages of the rows in use get backed, so a domain costs a page
+ * of slots per few threads, not a row for each of HP_MAX_THREADS.
+ */
+static inline void __hp_table_map(list_hp_t *hp, int node)
+{
+    if (atomic_load_explicit(&hp->node_hps[node], memory_order_acquire))
+        return;
+
+    size_t size = __hp_table_size(hp);
+    void *table = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(table != MAP_FAILED);
+#ifdef HP_NUMA
+    hp_numa_bind(table, size, node);
+#endif
+
+    atomic_uintptr_t *expected = NULL;
+    if (!atomic_compare_exchange_strong(&hp->node_hps[node], &expected,
+                                        table))
+        munmap(table, size);
+}
+
+/* Allocate the retire list of slot 'itid' and its buffers, the first time
+ * a thread with this slot attaches to the domain. Until then a slot costs
+ * the domain one pointer.
+ */
+static inline retirelist_t *__hp_rl_init(list_hp_t *hp, int itid)
+{
+    retirelist_t *rl = aligned_alloc(128, sizeof(*rl));
+    assert(rl);
+    memset(rl, 0, sizeof(*rl));
+    rl->cap = HP_RETIRED_INIT;
+    rl->list = calloc(HP_RETIRED_INIT, sizeof(uintptr_t));
+    assert(rl->list);
+#if HP_BACKEND == HP_BACKEND_EPOCH
+    rl->era = calloc(HP_RETIRED_INIT, sizeof(uintptr_t));
+#elif HP_SCAN == HP_SCAN_SORTED
+    rl->snap = calloc(HP_MAX_THREADS * hp->max_hps, sizeof(uintptr_t));
+#elif HP_SCAN == HP_SCAN_SIMD
+    rl->snap =
+        calloc(hp_simd_round(HP_MAX_THREADS * hp->max_hps), sizeof(uintptr_t));
+#endif
+#if HP_RECLAIM == HP_RECLAIM_BACKGROUND
+    list_hp_ring_t *ring = aligned_alloc(128, sizeof(list_hp_ring_t));
+    assert(ring);
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    rl->ring = ring;
+#endif
+    // the reclaimer and list_hp_stats() may be reading the slots already
+    atomic_store_explicit(&hp->rl[itid], rl, memory_order_release);
+    return rl;
+}
+
+/* The retire list of slot 'itid', NULL if no thread with it attached yet */
+static inline retirelist_t *__hp_rl(list_hp_t *hp, int itid)
+{
+    return atomic_load_explicit(&hp->rl[itid], memory_order_acquire);
+}
+
+#if HP_RECLAIM == HP_RECLAIM_BACKGROUND
+static void *__hp_reclaimer(void *arg);
+#endif
+
+/* Create a new hazard pointer array of size 'max_hps' (or a reasonable
+ * default value if 'max_hps' is 0). The function 'deletefunc' will be
+ * used to delete objects protected by hazard pointers when it becomes
+ * safe to retire them.
+ *
+ * Several structures can share a domain as long as 'deletefunc' frees
+ * the objects of all of them. A thread then attaches to the domain once,
+ * and works on one structure at a time, since they share its slots.
+ */
+static inline list_hp_t *list_hp_new(size_t max_hps,
+                                     list_hp_deletefunc_t *deletefunc)
+{
+    list_hp_t *hp = aligned_alloc(128, sizeof(*hp));
+    assert(hp);
+
+    if (max_hps == 0)
+        max_hps = HP_MAX_HPS;
+
+    *hp = (list_hp_t){ .max_hps = max_hps, .deletefunc = deletefunc };
+#if HP_FENCE == HP_FENCE_ASYMMETRIC
+    __hp_membarrier_register();
+#endif
+
+    // The hazard table is one array with a row of 'stride' slots per
+    // thread. A row is max_hps slots rounded up to whole cache lines, so
+    // threads never write to the same line, and a scan reads the rows in
+    // order. The table and the retire lists are allocated by the attach.
+    hp->stride = (max_hps + CLPAD - 1) / CLPAD * CLPAD;
+
+#if HP_RECLAIM == HP_RECLAIM_BACKGROUND
+    int ret = pthread_create(&hp->reclaimer, NULL, __hp_reclaimer, hp);
+    assert(ret == 0 && "cannot start the reclaimer");
+    (void)ret;
+#endif
+
+    return hp;
+}
+
+/* Set the size of the objects retired in 'hp', for the byte counts of
+ * list_hp_stats(). A structure with objects of several sizes sets the
+ * mean, and the byte counts are estimates.
+ */
+static inline void list_hp_set_objsize(list_hp_t *hp, size_t objsize)
+{
+    hp->objsize = objsize;
+}
+
+/* Destroy a hazard pointer array and clean up all objects protected
+ * by hazard pointers.
+ */
+static inline void list_hp_destroy(list_hp_t *hp)
+{
+#if HP_RECLAIM == HP_RECLAIM_BACKGROUND
+    atomic_store(&hp->stop, true);
+    pthread_join(hp->reclaimer, NULL);
+#endif
+
+    list_hp_orphan_t *orphan = atomic_load(&hp->orphans);
+    while (orphan) {
+        list_hp_orphan_t *next = orphan->next;
+        for (int j = 0; j < orphan->size; j++)
+            hp->deletefunc((void *)orphan->list[j]);
+        free(orphan);
+        orphan = next;
+    }
+
+    for (int i = 0; i < HP_MAX_THREADS; i++) {
+        retirelist_t *rl = hp->rl[i];
+        if (!rl)
+            continue;
+        for (int j = 0; j < rl->size; j++) {
+            void *data = (void *)rl->list[j];
+            hp->deletefunc(data);
+        }
+        free(rl->snap);
+        free(rl->era);
+        free(rl->ring);
+        free(rl->list);
+        free(rl);
+    }
+    for (int node = 0; node < HP_NUMA_NODES; node++)
+        if (hp->node_hps[node])
+            munmap(hp->node_hps[node], __hp_table_size(hp));
+    free(hp);
+}
+
+/* The hazard slots of thread 'itid', its row in the hazard table */
+static inline atomic_uintptr_t *__hp_row(list_hp_t *hp, int itid)
+{
+#ifdef HP_NUMA
+    int node = tid_node[itid];
+#else
+    int node = 0;
+#endif
+    atomic_uintptr_t *table =
+        atomic_load_explicit(&hp->node_hps[node], memory_order_relaxed);
+    return &table[itid * hp->stride];
+}
+
+/* The hazard table of 'node' for the scans, and in *hwm the number of rows
+ * that may be in use. Without HP_NUMA there is only node 0.
+ */
+static inline atomic_uintptr_t *__hp_table(list_hp_t *hp, int node, int *hwm)
+{
+    // the table is mapped before the mark is raised
+#ifdef HP_NUMA
+    *hwm = atomic_load(&hp->node_hwm[node]);
+#else
+    *hwm = atomic_load(&hp->hwm);
+#endif
+    if (!*hwm)
+        return NULL;
+    return atomic_load_explicit(&hp->node_hps[node], memory_order_acquire);
+}
+
+/* The calling thread's view of a domain: its row of hazard slots and its
+ * retire list, found once by list_hp_thread() instead of on every call.
+ * The list_hpt_* calls take it in place of the domain, the list_hp_* ones
+ * are wrappers that look it up each time. A handle is only valid in the
+ * thread that got it, between its attach and its detach.
+ */
+typedef struct {
+    list_hp_t *hp;
+    atomic_uintptr_t *row;
+    retirelist_t *rl;
+} list_hp_thread_t;
+
+/* The handle of the calling thread, which must be attached to 'hp' */
+static inline list_hp_thread_t list_hp_thread(list_hp_t *hp)
+{
+    int itid = tid();
+    return (list_hp_thread_t){
+        .hp = hp,
+        .row = __hp_row(hp, itid),
+        .rl = atomic_load_explicit(&hp->rl[itid], memory_order_relaxed),
+    };
+}
+
+/* Clear all hazard pointers in the array for the current thread.
+ * Progress condition: wait-free bounded (by max_hps)
+ */
+static inline void list_hpt_clear(const list_hp_thread_t *th)
+{
+#if HP_BACKEND == HP_BACKEND_EPOCH
+    atomic_store_explicit(&th->row[0], 0, memory_order_release);
+#else
+    for (int i = 0; i < th->hp->max_hps; i++)
+        atomic_store_explicit(&th->row[i], 0, memory_order_release);
+#endif
+}
+
+static inline void list_hp_clear(list_hp_t *hp)
+{
+    list_hp_thread_t th = list_hp_thread(hp);
+    list_hpt_clear(&th);
+}
+
+#if HP_BACKEND == HP_BACKEND_EPOCH
+
+/* Announce the global epoch, unless the thread is in it already. Like a
+ * hazard pointer, the announcement has to be visible before any node is
+ * read.
+ */
+static inline void __ebr_enter(const list_hp_thread_t *th)
+{
+    atomic_uintptr_t *slot = &th->row[0];
+    if (atomic_load_explicit(slot, memory_order_relaxed))
+        return;
+    uintptr_t epoch = atomic_load(&th->hp->epoch);
+    __hp_publish(slot, (epoch << 1) | 1);
+}
+
+#endif
+
+/* This returns the same value that is passed as ptr.
+ * Progress condition: wait-free population oblivious.
+ * ihp can be HP_CURR, HP_NEXT, HP_PREV
+ */
+static inline uintptr_t list_hpt_protect_ptr(const list_hp_thread_t *th,
+                                             int ihp, uintptr_t ptr)
+{
+    assert(ihp < th->hp->max_hps && "the domain has no such slot");
+#if HP_BACKEND == HP_BACKEND_EPOCH
+    (void)ihp;
+    __ebr_enter(th);
+#else
+    __hp_publish(&th->row[ihp], ptr);
+#endif
+    return ptr;
+}
+
+static inline uintptr_t list_hp_protect_ptr(list_hp_t *hp, int ihp,
+                                            uintptr_t ptr)
+{
+    list_hp_thread_t th = list_hp_thread(hp);
+    return list_hpt_protect_ptr(&th, ihp, ptr);
+}
+
+/* Same as list_hp_protect_ptr(), but explicitly uses memory_order_release.
+ * Progress condition: wait-free population oblivious.
+ */
+static inline uintptr_t list_hpt_protect_release(const list_hp_thread_t *th,
+                                                 int ihp, uintptr_t ptr)
+{
+    assert(ihp < th->hp->max_hps && "the domain has no such slot");
+#if HP_BACKEND == HP_BACKEND_EPOCH
+    (void)ihp;
+    __ebr_enter(th);
+#else
+    atomic_store_explicit(&th->row[ihp], ptr, memory_order_release);
+#endif
+    return ptr;
+}
+
+static inline uintptr_t list_hp_protect_release(list_hp_t *hp, int ihp,
+                                                uintptr_t ptr)
+{
+    list_hp_thread_t th = list_hp_thread(hp);
+    return list_hpt_protect_release(&th, ihp, ptr);
+}
+
+/* The scan threshold for the threads attached right now */
+static inline int __hp_threshold(list_hp_t *hp)
+{
+    int nthreads = atomic_load_explicit(&hp->nthreads, memory_order_relaxed);
+    return nthreads * hp->max_hps * (1 + HP_THRESHOLD_K);
+}
+
+/* The epoch objects retired now are tagged with */
+static inline uintptr_t __hp_era(list_hp_t *hp)
+{
+#if HP_BACKEND == HP_BACKEND_EPOCH
+    return atomic_load(&hp->epoch);
+#else
+    (void)hp;
+    return 0;
+#endif
+}
+
+/* The counters of list_hp_stats() have a single writer, the owner of the
+ * retire list, so they are plain relaxed stores and never a locked
+ * instruction.
+ */
+static inline void __hp_stat_add(atomic_uint_fast64_t *c, uint64_t n)
+{
+    atomic_store_explicit(
+        c, atomic_load_explicit(c, memory_order_relaxed) + n,
+        memory_order_relaxed);
+}
+
+/* Publish the size of 'rl' and its peak */
+static inline void __hp_stat_size(retirelist_t *rl)
+{
+    atomic_store_explicit(&rl->st_size, rl->size, memory_order_relaxed);
+    if (rl->size > atomic_load_explicit(&rl->st_peak, memory_order_relaxed))
+        atomic_store_explicit(&rl->st_peak, rl->size, memory_order_relaxed);
+}
+
+static inline void __hp_append(retirelist_t *rl, uintptr_t ptr, uintptr_t era)
+{
+    if (rl->size == rl->cap) {
+        rl->cap *= 2;
+        rl->list = realloc(rl->list, rl->cap * sizeof(rl->list[0]));
+        assert(rl->list);
+#if HP_BACKEND == HP_BACKEND_EPOCH
+        rl->era = realloc(rl->era, rl->cap * sizeof(rl->era[0]));
+        assert(rl->era);
+#endif
+    }
+#if HP_BACKEND == HP_BACKEND_EPOCH
+    rl->era[rl->size] = era;
+#else
+    (void)era;
+#endif
+    rl->list[rl->size++] = ptr;
+    __hp_stat_size(rl);
+}
+
+/* Keep track of the peak number of retired objects that are not freed */
+static inline void __hp_account(list_hp_t *hp, long delta)
+{
+    long now = atomic_fetch_add_explicit(&hp->unreclaimed, delta,
+                                         memory_order_relaxed) +
+               delta;
+    long peak = atomic_load_explicit(&hp->peak, memory_order_relaxed);
+    while (now > peak && !atomic_compare_exchange_weak(&hp->peak, &peak, now))
+        ;
+}
+
+/* Move the objects of every orphan list into 'rl'. Their epochs are not
+ * kept, they are tagged with the current one, which is only later.
+ */
+static inline void __hp_adopt(list_hp_t *hp, retirelist_t *rl)
+{
+    if (!atomic_load_explicit(&hp->orphans, memory_order_relaxed))
+        return;
+
+    list_hp_orphan_t *orphan = atomic_exchange(&hp->orphans, NULL);
+    uintptr_t era = __hp_era(hp);
+    while (orphan) {
+        list_hp_orphan_t *next = orphan->next;
+        for (int i = 0; i < orphan->size; i++)
+            __hp_append(rl, orphan->list[i], era);
+        atomic_fetch_sub_explicit(&hp->orphaned, orphan->size,
+                                  memory_order_relaxed);
+        free(orphan);
+        orphan = next;
+    }
+}
+
+#if HP_BACKEND == HP_BACKEND_EPOCH
+
+/* Move the global epoch on if every thread inside an operation announced
+ * it. Returns the global epoch.
+ */
+static inline uintptr_t __ebr_try_advance(list_hp_t *hp)
+{
+    uintptr_t epoch = atomic_load(&hp->epoch);
+    for (int node = 0; node < HP_NUMA_NODES; node++) {
+        int hwm;
+        atomic_uintptr_t *table = __hp_table(hp, node, &hwm);
+        for (int itid = 0; itid < hwm; itid++) {
+            uintptr_t a = atomic_load(&table[itid * hp->stride]);
+            if (a && (a >> 1) != epoch)
+                return epoch;
+        }
+    }
+    if (atomic_compare_exchange_strong(&hp->epoch, &epoch, epoch + 1))
+        return epoch + 1;
+    return epoch;
+}
+
+#elif HP_SCAN == HP_SCAN_SORTED || HP_SCAN == HP_SCAN_SIMD
+
+static int __hp_ptr_cmp(const void *a, const void *b)
+{
+    uintptr_t x = *(const uintptr_t *)a, y = *(const uintptr_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Copy every non-null hazard pointer into 'snap' and sort it.
+ * Returns the number of entries in the snapshot.
+ */
+static inline int __hp_snapshot(list_hp_t *hp, uintptr_t *snap)
+{
+    int n = 0;
+    // one pass over the table of each node
+    for (int node = 0; node < HP_NUMA_NODES; node++) {
+        int hwm;
+        atomic_uintptr_t *table = __hp_table(hp, node, &hwm);
+        for (int itid = 0; itid < hwm; itid++) {
+            atomic_uintptr_t *row = &table[itid * hp->stride];
+            for (int ihp = 0; ihp < hp->max_hps; ihp++) {
+                uintptr_t ptr = atomic_load(&row[ihp]);
+                if (ptr)
+                    snap[n++] = ptr;
+            }
+        }
+    }
+#if HP_SCAN == HP_SCAN_SIMD
+    if (n <= HP_SIMD_MAX) {
+        // the kernel reads whole vectors, pad them with null pointers
+        for (int i = n; i < hp_simd_round(n); i++)
+            snap[i] = 0;
+        return n;
+    }
+#endif
+    qsort(snap, n, sizeof(snap[0]), __hp_ptr_cmp);
+    return n;
+}
+
+static inline bool __hp_snapshot_find(const uintptr_t *snap, int n,
+                                      uintptr_t obj)
+{
+#if HP_SCAN == HP_SCAN_SIMD
+    if (n <= HP_SIMD_MAX)
+        return hp_simd_find(snap, n, obj);
+#endif
+    int lo = 0, hi = n;
+    while (lo < hi) {
+        int mid = lo + ((hi - lo) >> 1);
+        if (snap[mid] < obj)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < n && snap[lo] == obj;
+}
+
+#else
+
+static inline bool __hp_is_protected(list_hp_t *hp, uintptr_t obj)
+{
+    for (int node = 0; node < HP_NUMA_NODES; node++) {
+        int hwm;
+        atomic_uintptr_t *table = __hp_table(hp, node, &hwm);
+        for (int itid = 0; itid < hwm; itid++) {
+            atomic_uintptr_t *row = &table[itid * hp->stride];
+            // in increasing order, see HP_SCAN
+            for (int ihp = 0; ihp < hp->max_hps; ihp++) {
+                // if the thread's hp stored the ptr equal to obj
+                // cannot delete.
+                if (atomic_load(&row[ihp]) == obj)
+                    return true;
+            }
+        }
+    }
+    return false;
+}
+
+#endif
+
+/* Free every object of 'rl' that is not protected by a hazard pointer
+ * (or, with epochs, that was retired two epochs ago).
+ */
+static inline void __hp_scan(list_hp_t *hp, retirelist_t *rl)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    __hp_account(hp, rl->pending);
+    rl->pending = 0;
+    __hp_heavy_barrier();
+
+#if HP_BACKEND == HP_BACKEND_EPOCH
+    uintptr_t epoch = __ebr_try_advance(hp);
+#elif HP_SCAN == HP_SCAN_SORTED || HP_SCAN == HP_SCAN_SIMD
+    int nsnap = __hp_snapshot(hp, rl->snap);
+#endif
+
+    // Partition the retire list in one pass: the objects that are still
+    // protected are moved to [0, nkeep), the ones we can delete end up
+    // in [nkeep, size) and are freed as a batch afterwards.
+    int size = rl->size, nkeep = 0;
+    uintptr_t *list = rl->list;
+    for (int iret = 0; iret < size; iret++) {
+        uintptr_t obj = list[iret];
+#if HP_BACKEND == HP_BACKEND_EPOCH
+        uintptr_t era = rl->era[iret];
+        bool can_delete = era + 2 <= epoch;
+        if (!can_delete) {
+            rl->era[iret] = rl->era[nkeep];
+            rl->era[nkeep] = era;
+        }
+#elif HP_SCAN == HP_SCAN_SORTED || HP_SCAN == HP_SCAN_SIMD
+        bool can_delete = !__hp_snapshot_find(rl->snap, nsnap, obj);
+#else
+        bool can_delete = !__hp_is_protected(hp, obj);
+#endif
+        if (!can_delete) {
+            list[iret] = list[nkeep];
+            list[nkeep++] = obj;
+        }
+    }
+    rl->size = nkeep;
+    __hp_account(hp, nkeep - size);
+
+    // when this obj is not in all the hp, delete it.
+    for (int iret = nkeep; iret < size; iret++)
+        hp->deletefunc((void *)list[iret]);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t ns = (end.tv_sec - start.tv_sec) * 1000000000 +
+                  (end.tv_nsec - start.tv_nsec);
+    __hp_stat_size(rl);
+    __hp_stat_add(&rl->st_scans, 1);
+    __hp_stat_add(&rl->st_freed, size - nkeep);
+    __hp_stat_add(&rl->st_scan_ns, ns);
+    if (ns > atomic_load_explicit(&rl->st_scan_max_ns, memory_order_relaxed))
+        atomic_store_explicit(&rl->st_scan_max_ns, ns, memory_order_relaxed);
+}
+
+/* The threshold if 'rl' is due for a scan, 0 otherwise */
+static inline int __hp_scan_due(list_hp_t *hp, retirelist_t *rl)
+{
+    int threshold = __hp_threshold(hp);
+#if HP_BACKEND == HP_BACKEND_EPOCH
+    // The list stays long until the epoch moves on, scan again once
+    // another threshold of objects has been retired, not on every retire.
+    return rl->pending < threshold ? 0 : threshold;
+#else
+    return rl->size < threshold ? 0 : threshold;
+#endif
+}
+
+#if HP_RECLAIM == HP_RECLAIM_BACKGROUND
+
+/* Hand 'ptr' over to the reclaimer, waiting for room in the ring. */
+static inline void __hp_ring_push(list_hp_ring_t *ring, uintptr_t ptr)
+{
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    while (tail - atomic_load_explicit(&ring->head, memory_order_acquire) ==
+           HP_RING_SIZE) {
+        analysis_add(ST_HP_STALLS, 1);
+        sched_yield();
+    }
+    ring->buf[tail & (HP_RING_SIZE - 1)] = ptr;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+/* Move the objects of 'ring' into 'rl'. Returns how many were moved. */
+static inline int __hp_ring_drain(list_hp_t *hp, list_hp_ring_t *ring,
+                                  retirelist_t *rl)
+{
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    // objects are tagged with the epoch they are drained in, a later one
+    uintptr_t era = __hp_era(hp);
+    for (unsigned i = head; i != tail; i++)
+        __hp_append(rl, ring->buf[i & (HP_RING_SIZE - 1)], era);
+    rl->pending += tail - head;
+    atomic_store_explicit(&ring->head, tail, memory_order_release);
+    return tail - head;
+}
+
+#endif
+
+/* Retire an object that is no longer in use by any thread, calling
+ * the delete function that was specified in list_hp_new().
+ *
+ * Progress condition: wait-free bounded (by the number of threads squared),
+ * amortized O(log H) per call. With HP_RECLAIM_BACKGROUND it is O(1) as
+ * long as the reclaimer keeps up, and blocks otherwise.
+ */
+static inline void list_hpt_retire(const list_hp_thread_t *th, uintptr_t ptr)
+{
+    list_hp_t *hp = th->hp;
+    retirelist_t *rl = th->rl;
+    analysis_add(ST_HP_RETIRES, 1);
+#if HP_RECLAIM == HP_RECLAIM_BACKGROUND
+    (void)hp;
+    __hp_ring_push(rl->ring, ptr);
+#else
+    // append the ptr we want to delete
+    __hp_append(rl, ptr, __hp_era(hp));
+    rl->pending++;
+
+    int threshold = __hp_scan_due(hp, rl);
+    if (!threshold)
+        return;
+    analysis_add(ST_HP_SCANS, 1);
+    analysis_add(ST_HP_THRES, threshold);
+
+    latency_scope(LAT_HP_SCAN);
+    __hp_adopt(hp, rl);
+    __hp_scan(hp, rl);
+#endif
+}
+
+static inline void list_hp_retire(list_hp_t *hp, uintptr_t ptr)
+{
+    list_hp_thread_t th = list_hp_thread(hp);
+    list_hpt_retire(&th, ptr);
+}
+
+/* Register the calling thread with the domain. This must be called by
+ * every thread before it uses the domain, and it returns the slot of the
+ * thread. The slot is the lowest one that is free, and the slots of the
+ * threads that have left are reused.
+ */
+static inline int list_hp_attach(list_hp_t *hp)
+{
+    if (tid_refs++ == 0) {
+        tid_v = __tid_acquire();
+#ifdef HP_NUMA
+        tid_node[tid_v] = __hp_numa_current();
+#endif
+    }
+
+    // allocate the retire list before the reclaimer can see the slot
+    retirelist_t *rl =
+        atomic_load_explicit(&hp->rl[tid_v], memory_order_relaxed);
+    if (!rl)
+        rl = __hp_rl_init(hp, tid_v);
+
+    // map the table and raise the high-water mark before any hazard
+    // pointer is published
+    int node = hp_numa_node();
+    __hp_table_map(hp, node);
+#ifdef HP_NUMA
+    int nhwm = atomic_load(&hp->node_hwm[node]);
+    while (nhwm <= tid_v && !atomic_compare_exchange_weak(&hp->node_hwm[node],
+                                                          &nhwm, tid_v + 1))
+        ;
+#endif
+    int hwm = atomic_load(&hp->hwm);
+    while (hwm <= tid_v &&
+           !atomic_compare_exchange_weak(&hp->hwm, &hwm, tid_v + 1))
+        ;
+    atomic_fetch_add(&hp->nthreads, 1);
+
+    __hp_adopt(hp, rl);
+    return tid_v;
+}
+
+/* Unregister the calling thread from the domain. The objects it retired
+ * that are still protected are handed over to the orphan list of the
+ * domain, which is adopted by the next thread that scans or attaches.
+ */
+static inline void list_hp_detach(list_hp_t *hp)
+{
+    retirelist_t *rl =
+        atomic_load_explicit(&hp->rl[tid()], memory_order_relaxed);
+
+    list_hp_clear(hp);
+    __hp_scan(hp, rl);
+    if (rl->size) {
+        list_hp_orphan_t *orphan =
+            malloc(sizeof(*orphan) + rl->size * sizeof(orphan->list[0]));
+        assert(orphan);
+        orphan->size = rl->size;
+        memcpy(orphan->list, rl->list, rl->size * sizeof(rl->list[0]));
+        atomic_fetch_add_explicit(&hp->orphaned, rl->size,
+                                  memory_order_relaxed);
+        rl->size = 0;
+        __hp_stat_size(rl);
+
+        orphan->next = atomic_load(&hp->orphans);
+        while (!atomic_compare_exchange_weak(&hp->orphans, &orphan->next,
+                                             orphan))
+            ;
+    }
+    atomic_fetch_sub(&hp->nthreads, 1);
+
+    if (--tid_refs == 0) {
+        __tid_release(tid_v);
+        tid_v = TID_UNKNOWN;
+    }
+}
+
+#if HP_RECLAIM == HP_RECLAIM_BACKGROUND
+
+/* The reclaimer attaches like any thread, so it has a retire list and a
+ * pool cache of its own, but it never publishes a hazard pointer. It
+ * collects the objects of every ring into its retire list, and once that
+ * is due it scans it with one snapshot for all threads. Once stopped, it
+ * drains the rings a last time, and what is left is freed by
+ * list_hp_destroy().
+ */
+static void *__hp_reclaimer(void *arg)
+{
+    list_hp_t *hp = arg;
+
+    analysis_role("reclaim");
+    list_hp_attach(hp);
+    retirelist_t *rl =
+        atomic_load_explicit(&hp->rl[tid()], memory_order_relaxed);
+
+    while (true) {
+        bool stop = atomic_load(&hp->stop);
+        int drained = 0;
+        int hwm = atomic_load(&hp->hwm);
+        for (int itid = 0; itid < hwm; itid++) {
+            retirelist_t *other = __hp_rl(hp, itid);
+            // no thread with this slot attached to the domain yet
+            if (other)
+                drained += __hp_ring_drain(hp, other->ring, rl);
+        }
+        __hp_adopt(hp, rl);
+
+        int threshold = __hp_scan_due(hp, rl);
+        if (threshold || stop) {
+            analysis_add(ST_HP_SCANS, 1);
+            analysis_add(ST_HP_THRES, threshold);
+            latency_scope(LAT_HP_SCAN);
+            __hp_scan(hp, rl);
+        }
+        if (stop)
+            break;
+        if (!drained) {
+            struct timespec idle = { .tv_nsec = HP_RECLAIM_IDLE_NS };
+            nanosleep(&idle, NULL);
+        }
+    }
+
+    list_hp_detach(hp);
+    return NULL;
+}
+
+#endif
+
+typedef struct {
+    long unreclaimed, peak; /* retired objects not freed yet */
+    size_t bytes, peak_bytes; /* the same, times the object size */
+    uint64_t scans, freed; /* objects freed by the scans */
+    uint64_t scan_ns, scan_max_ns; /* time spent in the scans */
+} list_hp_stat_t;
+
+typedef struct {
+    list_hp_stat_t total;
+    int nslots; /* entries of 'thread' filled in */
+    list_hp_stat_t thread[HP_MAX_THREADS]; /* by thread slot */
+} list_hp_stats_t;
+
+/* Fill 'st' with the reclamation counters of 'hp', per thread slot and in
+ * total. It can be called at any time from any thread, attached or not:
+ * it only reads counters that the owners of the slots keep up to date
+ * with relaxed stores, so the numbers are consistent per counter, not
+ * with each other. The counters of a slot are kept when its thread
+ * detaches, and go on with the next thread that gets it.
+ *
+ * The objects of a slot are the ones in its retire list and, with
+ * HP_RECLAIM_BACKGROUND, the ones in its ring that the reclaimer did not
+ * collect yet. The scans of that mode are all done by the reclaimer's own
+ * slot. The total also counts the objects of threads that left, and its
+ * peak is the domain's, taken at the start of the scans, where the lists
+ * are the longest.
+ */
+static inline void list_hp_stats(list_hp_t *hp, list_hp_stats_t *st)
+{
+    list_hp_stat_t *total = &st->total;
+
+    memset(total, 0, sizeof(*total));
+    st->nslots = atomic_load(&hp->hwm);
+    for (int itid = 0; itid < st->nslots; itid++) {
+        retirelist_t *rl = __hp_rl(hp, itid);
+        list_hp_stat_t *t = &st->thread[itid];
+
+        memset(t, 0, sizeof(*t));
+        if (!rl)
+            continue;
+
+        t->unreclaimed =
+            atomic_load_explicit(&rl->st_size, memory_order_relaxed);
+        t->peak = atomic_load_explicit(&rl->st_peak, memory_order_relaxed);
+#if HP_RECLAIM == HP_RECLAIM_BACKGROUND
+        t->unreclaimed +=
+            atomic_load_explicit(&rl->ring->tail, memory_order_relaxed) -
+            atomic_load_explicit(&rl->ring->head, memory_order_relaxed);
+        if (t->unreclaimed > t->peak)
+            t->peak = t->unreclaimed;
+#endif
+        t->bytes = t->unreclaimed * hp->objsize;
+        t->peak_bytes = t->peak * hp->objsize;
+        t->scans = atomic_load_explicit(&rl->st_scans, memory_order_relaxed);
+        t->freed = atomic_load_explicit(&rl->st_freed, memory_order_relaxed);
+        t->scan_ns =
+            atomic_load_explicit(&rl->st_scan_ns, memory_order_relaxed);
+        t->scan_max_ns =
+            atomic_load_explicit(&rl->st_scan_max_ns, memory_order_relaxed);
+
+        total->unreclaimed += t->unreclaimed;
+        total->scans += t->scans;
+        total->freed += t->freed;
+        total->scan_ns += t->scan_ns;
+        if (t->scan_max_ns > total->scan_max_ns)
+            total->scan_max_ns = t->scan_max_ns;
+    }
+    total->unreclaimed +=
+        atomic_load_explicit(&hp->orphaned, memory_order_relaxed);
+    total->peak = atomic_load(&hp->peak);
+    if (total->unreclaimed > total->peak)
+        total->peak = total->unreclaimed;
+    total->bytes = total->unreclaimed * hp->objsize;
+    total->peak_bytes = total->peak * hp->objsize;
+}
+
+/* Print the backend and the peak number of retired objects that were
+ * waiting to be freed at the same time, then the totals of
+ * list_hp_stats().
+ */
+static inline void list_hp_report(list_hp_t *hp)
+{
+    printf("reclaim %s, peak unreclaimed %ld objects",
+           HP_BACKEND == HP_BACKEND_EPOCH ? "epoch" : "hazard",
+           atomic_load(&hp->peak));
+#if HP_SCAN == HP_SCAN_SIMD
+    printf(", scan %s", hp_simd_name);
+#endif
+#ifdef HP_NUMA
+    int nodes = 0;
+    for (int node = 0; node < HP_NUMA_NODES; node++)
+        nodes += atomic_load(&hp->node_hwm[node]) > 0;
+    printf(", hazard tables on %d nodes", nodes);
+#endif
+    printf("\n");
+
+    list_hp_stats_t *st = malloc(sizeof(*st));
+    assert(st);
+    list_hp_stats(hp, st);
+    list_hp_stat_t *t = &st->total;
+    printf("retired %ld objects (%zu bytes) not freed, peak %zu bytes, "
+           "%" PRIu64 " scans, %.1f freed/scan, scan %.0f ns avg, "
+           "%" PRIu64 " ns max\n",
+           t->unreclaimed, t->bytes, t->peak_bytes, t->scans,
+           t->scans ? (double)t->freed / t->scans : 0.0,
+           t->scans ? (double)t->scan_ns / t->scans : 0.0, t->scan_max_ns);
+    free(st);
+}
+
+#endif /* __LIST_HP_H__ */
@@ -0,0 +1,63 @@
+/*
+ * Layout of the list node shared by list.c, ordered.c and orderedv2.c.
+ *
+ * LIST_LAYOUT_PADDED puts magic and next on their own 128-byte line, so
+ * a node takes 256 bytes and key is not on the line of magic.
+ * LIST_LAYOUT_LINE keeps next and key on one 128-byte line.
+ * LIST_LAYOUT_PACKED has no padding at all, a node takes 16 bytes (32
+ * with magic), for large lists where false sharing is not a concern.
+ *
+ * Except for the padded layout, magic is only kept by debug builds.
+ */
+
+#ifndef __LIST_NODE_H__
+#define __LIST_NODE_H__
+
+#include <assert.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define LIST_LAYOUT_PADDED 0
+#define LIST_LAYOUT_LINE 1
+#define LIST_LAYOUT_PACKED 2
+
+#ifndef LIST_NODE_LAYOUT
+#define LIST_NODE_LAYOUT LIST_LAYOUT_PADDED
+#endif
+
+#if LIST_NODE_LAYOUT == LIST_LAYOUT_PADDED || !defined(NDEBUG)
+#define LIST_NODE_MAGIC
+#endif
+
+typedef uintptr_t list_key_t;
+
+typedef struct list_node {
+#if LIST_NODE_LAYOUT == LIST_LAYOUT_PADDED
+    alignas(128) uint32_t magic;
+    alignas(128) atomic_uintptr_t next;
+    list_key_t key;
+#else
+#if LIST_NODE_LAYOUT == LIST_LAYOUT_LINE
+    alignas(128) atomic_uintptr_t next;
+#else
+    alignas(2 * sizeof(uintptr_t)) atomic_uintptr_t next;
+#endif
+    list_key_t key;
+#ifdef LIST_NODE_MAGIC
+    uint32_t magic;
+#endif
+#endif
+} list_node_t;
+
+#define LIST_MAGIC (0xDEADBEAF)
+
+#ifdef LIST_NODE_MAGIC
+#define list_node_set_magic(node) ((node)->magic = LIST_MAGIC)
+#define list_node_check_magic(node) assert((node)->magic == LIST_MAGIC)
+#else
+#define list_node_set_magic(node) ((void)(node))
+#define list_node_check_magic(node) ((void)(node))
+#endif
+
+#endif /* __LIST_NODE_H__ */
@@ -0,0 +1,201 @@
+/*
+ * Walks of a sorted list of list_node_t, shared by the list variants: the
+ * lookup of ordered.c, orderedv2.c and hashset.c, and the find of
+ * orderedv2.c and hashset.c, which can start from the middle of the list.
+ * The lookup of list.c is the one of kvmap.h, on links instead of nodes.
+ *
+ * The list runs from a head node that is never deleted to a tail node
+ * whose key is above every other, and a deleted node has the low bit of
+ * its next field set. The includer defines is_marked(), get_unmarked()
+ * and get_unmarked_node() for that mark, and says which of its hazard
+ * slots a walk may move.
+ */
+
+#ifndef __LIST_WALK_H__
+#define __LIST_WALK_H__
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "analysis.h"
+#include "list_hp.h"
+#include "list_node.h"
+
+/* The hazard slots of the thread that a walk uses. start is only used by
+ * the callers of list_find_ordered() that resume from a node.
+ */
+typedef struct {
+    int next, curr, prev, start;
+} list_walk_hps_t;
+
+/* The node whose next field is 'prev' */
+#define prev_node(prev) ((uintptr_t)(prev)-offsetof(list_node_t, next))
+
+/*
+ * Lookup for the readers. It only moves its own hazard pointers: marked
+ * nodes are walked over but never unlinked, and the walk does not restart
+ * from the head when a writer gets in the way.
+ *
+ * next is safe to use once it is protected and curr is known to be still
+ * linked at that point, which holds when curr is unmarked, or when prev,
+ * the last unmarked node of the walk, still points to curr. When neither
+ * holds any more, the walk steps back to prev, and only falls back to the
+ * head when prev was deleted as well.
+ *
+ * 'start' is one more such prev to start from, a node before key that the
+ * caller keeps protected, or head. Returns whether key is in the list, and
+ * in *par_prev the last unmarked node of the walk, which is start or still
+ * protected by hps->prev.
+ */
+static inline bool list_lookup(const list_hp_thread_t *th,
+                               const list_walk_hps_t *hps, list_node_t *head,
+                               list_node_t *start, list_key_t key,
+                               list_node_t **par_prev)
+{
+    list_node_t *prev = start, *curr = start;
+    bool found;
+
+    while (true) {
+        uintptr_t next = atomic_load(&curr->next);
+
+        if (!(curr->key < key)) {
+            // a marked curr was deleted at some point during the walk
+            found = curr->key == key && !is_marked(next);
+            break;
+        }
+
+        (void)list_hpt_protect_ptr(th, hps->next, get_unmarked(next));
+        if (atomic_load(&curr->next) != next)
+            continue;
+        if (!is_marked(next)) {
+            (void)list_hpt_protect_release(th, hps->prev, (uintptr_t)curr);
+            prev = curr;
+        } else if (atomic_load(&prev->next) != (uintptr_t)curr) {
+            (void)list_hpt_protect_release(th, hps->curr, (uintptr_t)prev);
+            curr = prev;
+            prev = head;
+            continue;
+        }
+        (void)list_hpt_protect_release(th, hps->curr, get_unmarked(next));
+        curr = get_unmarked_node(next);
+    }
+    *par_prev = prev;
+    return found;
+}
+
+/*
+ * The find of the writers. It returns whether key is in the list, with the
+ * last unmarked node before key in *par_prev, as its next field, the first
+ * node not below key in *par_curr and its next in *par_next. The marked
+ * nodes on the way are unlinked and retired.
+ *
+ * start is a next field whose node is before key: head, the next field of
+ * the node the list starts at, or the prev of a previous find whose node
+ * the caller keeps protected by hps->start, which the find never moves.
+ * When the node of start got deleted, the find starts over from head.
+ * The prev the find returns is protected by hps->prev, or is start when
+ * the find did not move, so a caller can resume from it after a failed
+ * CAS once it protected it by hps->start, see list_protect_start().
+ */
+static inline bool list_find_ordered(const list_hp_thread_t *th,
+                                     const list_walk_hps_t *hps,
+                                     atomic_uintptr_t *head, list_node_t *tail,
+                                     atomic_uintptr_t *start, list_key_t key,
+                                     atomic_uintptr_t **par_prev,
+                                     list_node_t **par_curr,
+                                     list_node_t **par_next)
+{
+    atomic_uintptr_t *prev = NULL;
+    list_node_t *curr = NULL, *next = NULL;
+
+try_again:
+    prev = start;
+    curr = (list_node_t *)atomic_load(prev);
+    (void)list_hpt_protect_ptr(th, hps->curr, (uintptr_t)curr);
+    // the node of start may be deleted by now, and then curr may already
+    // be freed. Only an unmarked start is known to be still linked.
+    if (atomic_load(prev) != get_unmarked(curr)) {
+        if (is_marked(atomic_load(prev)))
+            start = head;
+        goto_try_again;
+    }
+
+    while (true) {
+        // get next
+        next = (list_node_t *)atomic_load(&get_unmarked_node(curr)->next);
+        (void)list_hpt_protect_ptr(th, hps->next, get_unmarked(next));
+        // next may have been unlinked and freed before it was protected
+        if (atomic_load(&get_unmarked_node(curr)->next) != (uintptr_t)next)
+            goto_try_again;
+
+        // When start is not the head, curr may already be the right node.
+        if (!is_marked(next) && !(get_unmarked_node(curr)->key < key)) {
+            *par_curr = curr;
+            *par_prev = prev;
+            *par_next = next;
+            return get_unmarked_node(curr)->key == key;
+        }
+
+        // find left_node(prev) and right_node (curr)
+        do {
+            trav_inc;
+            if (!is_marked(next)) {
+                (void)list_hpt_protect_release(th, hps->prev,
+                                               get_unmarked(curr));
+                prev = &get_unmarked_node(curr)->next;
+            } else {
+                cons_inc;
+                // curr is marked delete, unlink it while it is still
+                // protected, nobody else may have done it.
+                uintptr_t tmp = get_unmarked(curr);
+                if (!CAS(prev, &tmp, get_unmarked(next)))
+                    goto_try_again;
+                list_hpt_retire(th, get_unmarked(curr));
+            }
+            (void)list_hpt_protect_release(th, hps->curr, get_unmarked(next));
+            curr = get_unmarked_node(next);
+            if (curr == tail)
+                break;
+            next = (list_node_t *)atomic_load(&get_unmarked_node(curr)->next);
+            (void)list_hpt_protect_ptr(th, hps->next, get_unmarked(next));
+            if (atomic_load(&get_unmarked_node(curr)->next) != (uintptr_t)next)
+                goto_try_again;
+        } while (is_marked(next) || get_unmarked_node(curr)->key < key);
+
+        if (atomic_load(prev) == get_unmarked(curr)) {
+            if (curr != tail && is_marked(get_unmarked_node(curr)->next))
+                goto_try_again;
+            else {
+                *par_curr = curr;
+                *par_prev = prev;
+                *par_next = next;
+                return get_unmarked_node(curr)->key == key;
+            }
+        }
+        curr = (list_node_t *)atomic_load(prev);
+        (void)list_hpt_protect_release(th, hps->curr, get_unmarked(curr));
+        if (atomic_load(prev) != get_unmarked(curr))
+            goto_try_again;
+
+    } /* while (true) */
+}
+
+/* Keep the node of 'prev' protected by hps->start, so that a find can
+ * start from prev, and come back to it when it retries, while it moves
+ * its other hazard pointers forward. A find leaves the node of the prev
+ * it returns protected by hps->prev, or by hps->start when it did not
+ * move, so it never goes unprotected in between. head is never deleted
+ * and needs no slot.
+ */
+static inline void list_protect_start(const list_hp_thread_t *th,
+                                      const list_walk_hps_t *hps,
+                                      atomic_uintptr_t *head,
+                                      atomic_uintptr_t *prev)
+{
+    if (prev != head)
+        (void)list_hpt_protect_release(th, hps->start, prev_node(prev));
+}
+
+#endif /* __LIST_WALK_H__ */
@@ -14,249 +14,31 @@
 #include <string.h>
 #include <threads.h>
 
-#ifdef ANALYSIS_OPS
+#include "analysis.h"
+#include "latency.h"
+#include "list_hp.h"
+#include "list_node.h"
+#include "pool.h"
 
-/*
- * "rtry" the number of retries in the __list_find function.
- * "cons" the number of wait-free contains in the __list_find function that curr
- * pointer pointed.
- * "trav" the number of list element traversal in the __list_find function.
- * "fail" the number of CAS() failures.
- * "del" the number of list_delete operation failed and restart again.
- * "ins" the number of list_insert operation failed and restart again.
- */
-static atomic_uint_fast64_t rtry = 0, cons = 0, trav = 0, fail = 0;
-static atomic_uint_fast64_t del = 0, ins = 0;
-static atomic_uint_fast64_t deletes = 0, inserts = 0;
-
-#define goto_try_again                                                         \
-    do {                                                                       \
-        atomic_fetch_add(&rtry, 1);                                            \
-        goto try_again;                                                        \
-    } while (0)
-#define cons_inc                                                                \
-    do {                                                                       \
-        atomic_fetch_add(&cons, 1);                                            \
-    } while (0)
-#define trav_inc                                                               \
-    do {                                                                       \
-        atomic_fetch_add(&trav, 1);                                            \
-    } while (0)
-#define CAS(obj, expected, desired)                                          \
-    ({                                                                       \
-        bool __ret = atomic_compare_exchange_strong(obj, expected, desired); \
-        if (!__ret)                                                          \
-            atomic_fetch_add(&fail, 1);                                      \
-        __ret;                                                               \
-    })
-#define del_inc                                                                \
-    do {                                                                       \
-        atomic_fetch_add(&del, 1);                                             \
-    } while (0)
-#define ins_inc                                                                \
-    do {                                                                       \
-        atomic_fetch_add(&ins, 1);                                             \
-    } while (0)
-#define deletes_inc                                                                \
-    do {                                                                       \
-        atomic_fetch_add(&deletes, 1);                                            \
-    } while (0)
-#define inserts_inc                                                               \
-    do {                                                                       \
-        atomic_fetch_add(&inserts, 1);                                            \
-    } while (0)
+#ifdef ANALYSIS_OPS
 
 void analysis_func(void)
 {
-    printf("%10s %10s %10s %10s %10s %10s %10s %10s\n", "rtry", "cons", "trav", "fail", "del", "ins", "deletes", "inserts");
+    printf("%10s %10s %10s %10s %10s %10s %10s %10s\n", "rtry", "cons", "trav",
+           "fail", "del", "ins", "deletes", "inserts");
     for (int i = 0; i < 87; i++)
         printf("-");
-    printf("\n%10ld %10ld %10ld %10ld %10ld %10ld %10ld %10ld\n", rtry, cons, trav, fail, del, ins, deletes, inserts);
+    printf("\n");
+    for (int i = 0; i < ST_NR_OPS; i++)
+        printf("%10" PRIu64 "%c", analysis_sum(i),
+               i == ST_NR_OPS - 1 ? '\n' : ' ');
+    list_hp_analysis();
+    analysis_breakdown();
 }
 
-#else
-
-#define goto_try_again                                                         \
-    do {                                                                       \
-        goto try_again;                                                        \
-    } while (0)
-#define cons_inc                                                                \
-    do {                                                                       \
-    } while (0)
-#define trav_inc                                                               \
-    do {                                                                       \
-    } while (0)
-#define CAS(obj, expected, desired)                                            \
-    ({ atomic_compare_exchange_strong(obj, expected, desired); })
-#define del_inc                                                                \
-    do {                                                                       \
-    } while (0)
-#define ins_inc                                                                \
-    do {                                                                       \
-    } while (0)
-#define deletes_inc                                                                \
-    do {                                                                       \
-    } while (0)
-#define inserts_inc                                                               \
-    do {                                                                       \
-    } while (0)
-
 #endif
 
 
-#define HP_MAX_THREADS 128
-#define HP_MAX_HPS 5 /* This is named 'K' in the HP paper */
-#define CLPAD (128 / sizeof(uintptr_t)) /* 128 / 8 = 16 */
-#define HP_THRESHOLD_R 0 /* This is named 'R' in the HP paper */
-
-/* Maximum number of retired objects per thread */
-#define HP_MAX_RETIRED (HP_MAX_THREADS * HP_MAX_HPS)
-
-#define TID_UNKNOWN -1
-
-typedef struct {
-    int size;
-    uintptr_t *list;
-} retirelist_t;
-
-typedef void(list_hp_deletefunc_t)(void *);
-
-typedef struct list_hp {
-    int max_hps;
-    alignas(128) atomic_uintptr_t *hp[HP_MAX_THREADS];
-    alignas(128) retirelist_t *rl[HP_MAX_THREADS * CLPAD];
-    list_hp_deletefunc_t *deletefunc;
-} list_hp_t;
-
-static thread_local int tid_v = TID_UNKNOWN;
-static atomic_int_fast32_t tid_v_base = ATOMIC_VAR_INIT(0);
-
-static inline int tid(void)
-{
-    // atomic_fetch_add return previous value
-    if (tid_v == TID_UNKNOWN) {
-        tid_v = atomic_fetch_add(&tid_v_base, 1);
-        assert(tid_v < HP_MAX_THREADS);
-    }
-    return tid_v;
-}
-
-/* Create a new hazard pointer array of size 'max_hps' (or a reasonable
- * default value if 'max_hps' is 0). The function 'deletefunc' will be
- * used to delete objects protected by hazard pointers when it becomes
- * safe to retire them.
- */
-list_hp_t *list_hp_new(size_t max_hps, list_hp_deletefunc_t *deletefunc)
-{
-    list_hp_t *hp = aligned_alloc(128, sizeof(*hp));
-    assert(hp);
-
-    if (max_hps == 0)
-        max_hps = HP_MAX_HPS;
-
-    *hp = (list_hp_t){ .max_hps = max_hps, .deletefunc = deletefunc };
-
-    for (int i = 0; i < HP_MAX_THREADS; i++) {
-        // sizeof(hp->hp[i][0]) == sizeof(uintptr_t)
-        // nmemb * size = calloc(nmemb, size)
-        // retirelist_t *rl[HP_MAX_THREADS * CLPAD]
-        hp->hp[i] = calloc(CLPAD * 2, sizeof(hp->hp[i][0]));
-        hp->rl[i * CLPAD] = calloc(1, sizeof(*hp->rl[0]));
-        // why bound is max_hps not CLPAD * 2?
-        for (int j = 0; j < hp->max_hps; j++)
-            atomic_init(&hp->hp[i][j], 0);
-        hp->rl[i * CLPAD]->list = calloc(HP_MAX_RETIRED, sizeof(uintptr_t));
-    }
-
-    return hp;
-}
-
-/* Destroy a hazard pointer array and clean up all objects protected
- * by hazard pointers.
- */
-void list_hp_destroy(list_hp_t *hp)
-{
-    for (int i = 0; i < HP_MAX_THREADS; i++) {
-        free(hp->hp[i]);
-        retirelist_t *rl = hp->rl[i * CLPAD];
-        for (int j = 0; j < rl->size; j++) {
-            void *data = (void *)rl->list[j];
-            hp->deletefunc(data);
-        }
-        free(rl->list);
-        free(rl);
-    }
-    free(hp);
-}
-
-/* Clear all hazard pointers in the array for the current thread.
- * Progress condition: wait-free bounded (by max_hps)
- */
-void list_hp_clear(list_hp_t *hp)
-{
-    for (int i = 0; i < hp->max_hps; i++)
-        atomic_store_explicit(&hp->hp[tid()][i], 0, memory_order_release);
-}
-
-/* This returns the same value that is passed as ptr.
- * Progress condition: wait-free population oblivious.
- * ihp can be HP_CURR, HP_NEXT, HP_PREV
- */
-uintptr_t list_hp_protect_ptr(list_hp_t *hp, int ihp, uintptr_t ptr)
-{
-    atomic_store(&hp->hp[tid()][ihp], ptr);
-    return ptr;
-}
-
-/* Same as list_hp_protect_ptr(), but explicitly uses memory_order_release.
- * Progress condition: wait-free population oblivious.
- */
-uintptr_t list_hp_protect_release(list_hp_t *hp, int ihp, uintptr_t ptr)
-{
-    atomic_store_explicit(&hp->hp[tid()][ihp], ptr, memory_order_release);
-    return ptr;
-}
-
-/* Retire an object that is no longer in use by any thread, calling
- * the delete function that was specified in list_hp_new().
- *
- * Progress condition: wait-free bounded (by the number of threads squared)
- */
-void list_hp_retire(list_hp_t *hp, uintptr_t ptr)
-{
-    retirelist_t *rl = hp->rl[tid() * CLPAD];
-    // append the ptr we want to delete
-    rl->list[rl->size++] = ptr;
-    assert(rl->size < HP_MAX_RETIRED);
-
-    if (rl->size < HP_THRESHOLD_R)
-        return;
-
-    for (size_t iret = 0; iret < rl->size; iret++) {
-        uintptr_t obj = rl->list[iret];
-        bool can_delete = true;
-        for (int itid = 0; itid < HP_MAX_THREADS && can_delete; itid++) {
-            for (int ihp = hp->max_hps - 1; ihp >= 0; ihp--) {
-                // if the thread's hp stored the ptr equal to obj
-                // cannot delete.
-                if (atomic_load(&hp->hp[itid][ihp]) == obj) {
-                    // can_delete = false is breaking
-                    // the second  for loop
-                    can_delete = false;
-                    break;
-                }
-            }
-        }
-
-        // when this obj is not in all the hp, delete it.
-        if (can_delete) {
-            size_t bytes = (rl->size - iret) * sizeof(rl->list[0]);
-            memmove(&rl->list[iret], &rl->list[iret + 1], bytes);
-            rl->size--;
-            hp->deletefunc((void *)obj);
-        }
-    }
-}
 
 /*
  * The list structure and function
@@ -265,10 +47,6 @@ void list_hp_retire(list_hp_t *hp, uintptr_t ptr)
 
 #include <pthread.h>
 
-#define N_ELEMENTS 128
-#define N_THREADS (64 /*NNN*/)
-#define MAX_THREADS 128
-
 enum { HP_NEXT = 0, HP_CURR = 1, HP_PREV };
 
 #define is_marked(p) (bool)((uintptr_t)(p)&0x01)
@@ -278,13 +56,11 @@ enum { HP_NEXT = 0, HP_CURR = 1, HP_PREV };
 #define get_marked_node(p) ((list_node_t *)get_marked(p))
 #define get_unmarked_node(p) ((list_node_t *)get_unmarked(p))
 
-typedef uintptr_t list_key_t;
+#include "list_walk.h"
 
-typedef struct list_node {
-    alignas(128) uint32_t magic;
-    alignas(128) atomic_uintptr_t next;
-    list_key_t key;
-} list_node_t;
+static const list_walk_hps_t list_walk_hps = {
+    .next = HP_NEXT, .curr = HP_CURR, .prev = HP_PREV
+};
 
 /* Per list variables */
 
@@ -293,13 +69,15 @@ typedef struct list {
     list_hp_t *hp;
 } list_t;
 
-#define LIST_MAGIC (0xDEADBEAF)
+/* Nodes of every list, recycled by the thread that frees them */
+static pool_t node_pool = POOL_INIT(sizeof(list_node_t));
 
 list_node_t *list_node_new(list_key_t key)
 {
-    list_node_t *node = aligned_alloc(128, sizeof(*node));
+    list_node_t *node = pool_alloc(&node_pool);
     assert(node);
-    *node = (list_node_t){ .magic = LIST_MAGIC, .key = key };
+    *node = (list_node_t){ .key = key };
+    list_node_set_magic(node);
     inserts_inc;
     return node;
 }
@@ -308,8 +86,8 @@ void list_node_destroy(list_node_t *node)
 {
     if (!node)
         return;
-    assert(node->magic == LIST_MAGIC);
-    free(node);
+    list_node_check_magic(node);
+    pool_free(&node_pool, node);
     deletes_inc;
 }
 
@@ -338,7 +116,10 @@ try_again:
         // get next
         next = (list_node_t *)atomic_load(&get_unmarked_node(curr)->next);
         (void)list_hp_protect_ptr(list->hp, HP_NEXT, get_unmarked(next));
-        
+        // next may have been unlinked and freed before it was protected
+        if (atomic_load(&get_unmarked_node(curr)->next) != (uintptr_t)next)
+            goto_try_again;
+
         // find left_node(prev) and right_node (curr)
         do {
             trav_inc;
@@ -346,19 +127,23 @@ try_again:
                 (void)list_hp_protect_release(list->hp, HP_PREV,
                                           get_unmarked(curr));
                 prev = &get_unmarked_node(curr)->next;
-            }
-#ifdef ANALYSIS_OPS            
-            else
+            } else {
                 cons_inc;
-#endif
+                // curr is marked delete, unlink it while it is still
+                // protected, nobody else may have done it.
+                uintptr_t tmp = get_unmarked(curr);
+                if (!CAS(prev, &tmp, get_unmarked(next)))
+                    goto_try_again;
+                list_hp_retire(list->hp, get_unmarked(curr));
+            }
             (void)list_hp_protect_release(list->hp, HP_CURR, get_unmarked(next));
             curr = get_unmarked_node(next);
             if (get_unmarked(curr) == atomic_load((atomic_uintptr_t *)&list->tail))
-                break;            
-            //(void)list_hp_protect_release(list->hp, HP_CURR, get_unmarked(next));
-            //curr = next;
+                break;
             next = (list_node_t *)atomic_load(&get_unmarked_node(curr)->next);
             (void)list_hp_protect_ptr(list->hp, HP_NEXT, get_unmarked(next));
+            if (atomic_load(&get_unmarked_node(curr)->next) != (uintptr_t)next)
+                goto_try_again;
         } while (is_marked(next) || get_unmarked_node(curr)->key < *key);
 
         if (atomic_load(prev) == get_unmarked(curr)) {
@@ -371,18 +156,7 @@ try_again:
                 return get_unmarked_node(curr)->key == *key;
             }
         }
-        uintptr_t tmp = get_unmarked(curr);
-        if (CAS(prev, &tmp, get_unmarked(curr))) {
-            if (get_unmarked(curr) != atomic_load((atomic_uintptr_t *)&list->tail) && is_marked(get_unmarked_node(curr)->next)) {
-                goto_try_again;
-            }
-            else {
-                *par_curr = curr;
-                *par_prev = prev;
-                *par_next = next;
-                return get_unmarked_node(curr)->key == *key;                
-            }
-        }        
+        goto_try_again;
     } /*while (true)*/    
 }
 
@@ -391,8 +165,8 @@ bool list_insert(list_t *list, list_key_t key)
 {
     list_node_t *curr = NULL, *next = NULL;
     atomic_uintptr_t *prev = NULL;
-
-    list_node_t *node = list_node_new(key);
+    list_node_t *node = NULL;
+    latency_scope(LAT_INSERT);
 
     while (true) {
         if (__list_find_ordered(list, &key, &prev, &curr, &next)) {
@@ -400,7 +174,10 @@ bool list_insert(list_t *list, list_key_t key)
             list_hp_clear(list->hp);
             return false;
         }
-        
+
+        // only allocate once we know the key is absent
+        if (!node)
+            node = list_node_new(key);
         atomic_store_explicit(&node->next, (uintptr_t)curr,
                               memory_order_relaxed);
         uintptr_t tmp = get_unmarked(curr);
@@ -421,6 +198,7 @@ bool list_delete(list_t *list, list_key_t key)
 {
     list_node_t *curr, *next;
     atomic_uintptr_t *prev;
+    latency_scope(LAT_DELETE);
     while (true) {
         if (!__list_find_ordered(list, &key, &prev, &curr, &next)) {
             list_hp_clear(list->hp);
@@ -446,6 +224,18 @@ bool list_delete(list_t *list, list_key_t key)
     }
 }
 
+/* The lookup of list_walk.h, from the head */
+bool list_contains(list_t *list, list_key_t key)
+{
+    list_hp_thread_t th = list_hp_thread(list->hp);
+    list_node_t *head = (list_node_t *)atomic_load(&list->head), *prev;
+    latency_scope(LAT_CONTAINS);
+
+    bool found = list_lookup(&th, &list_walk_hps, head, head, key, &prev);
+    list_hpt_clear(&th);
+    return found;
+}
+
 list_t *list_new(void)
 {
     list_t *list = calloc(1, sizeof(*list));
@@ -453,6 +243,7 @@ list_t *list_new(void)
     list_node_t *head = list_node_new(0), *tail = list_node_new(UINTPTR_MAX);
     assert(head), assert(tail);
     list_hp_t *hp = list_hp_new(3, __list_node_delete);
+    list_hp_set_objsize(hp, sizeof(list_node_t));
 
     atomic_init(&head->next, (uintptr_t)tail);
     *list = (list_t){ .hp = hp };
@@ -466,93 +257,37 @@ void list_destroy(list_t *list)
 {
     assert(list);
     list_node_t *prev = (list_node_t *)atomic_load(&list->head);
-    list_node_t *node = (list_node_t *)atomic_load(&prev->next);
+    list_node_t *node = get_unmarked_node(atomic_load(&prev->next));
     while (node) {
         list_node_destroy(prev);
         prev = node;
-        node = (list_node_t *)atomic_load(&prev->next);
+        node = get_unmarked_node(atomic_load(&prev->next));
     }
     list_node_destroy(prev);
     list_hp_destroy(list->hp);
     free(list);
 }
 
-static uintptr_t elements[MAX_THREADS + 1][N_ELEMENTS];
-
-static void *insert_thread(void *arg)
-{
-    list_t *list = (list_t *)arg;
-
-    for (size_t i = 0; i < N_ELEMENTS; i++)
-        (void)list_insert(list, (uintptr_t)&elements[tid()][i]);
-
-    return NULL;
-}
-
-// odd
-static void *delete_thread(void *arg)
-{
-    list_t *list = (list_t *)arg;
+#define bench_list_t list_t
+#define bench_new list_new
+#define bench_destroy list_destroy
+#define bench_insert list_insert
+#define bench_delete list_delete
+#define bench_contains list_contains
+#define bench_thread_init(list) list_hp_attach((list)->hp)
+#define bench_thread_fini(list) list_hp_detach((list)->hp)
+#define bench_report(list) list_hp_report((list)->hp)
 
-    for (size_t i = 0; i < N_ELEMENTS; i++)
-        (void)list_delete(list, (uintptr_t)&elements[tid()][i]);
-        
-    return NULL;
-}
+#include "bench.h"
 
-#include <time.h>
-
-#define time_diff(start, end)                                                  \
-    (end.tv_nsec - start.tv_nsec < 0 ?                                         \
-             (1000000000 + end.tv_nsec - start.tv_nsec) :                      \
-             (end.tv_nsec - start.tv_nsec))
-#define time_check(_FUNC_)                                                     \
-    do {                                                                       \
-        struct timespec time_start;                                            \
-        struct timespec time_end;                                              \
-        double during;                                                         \
-        clock_gettime(CLOCK_MONOTONIC, &time_start);                           \
-        _FUNC_;                                                                \
-        clock_gettime(CLOCK_MONOTONIC, &time_end);                             \
-        during = time_diff(time_start, time_end);                              \
-        printf("%f\n", during);                                                \
-    } while (0)
-
-static inline int test(void)
+int main(int argc, char *argv[])
 {
-    list_t *list = list_new();
-
-    pthread_t thr[N_THREADS];
-
-    for (size_t i = 0; i < N_THREADS; i++)
-        pthread_create(&thr[i], NULL, (i & 1) ? delete_thread : insert_thread,
-                       list);
-
-    for (size_t i = 0; i < N_THREADS; i++)
-        pthread_join(thr[i], NULL);
-
-    for (size_t i = 0; i < N_ELEMENTS; i++) {
-        for (size_t j = 0; j < tid_v_base; j++)
-            list_delete(list, (uintptr_t)&elements[j][i]);
-    }
-
-    list_destroy(list);
-
-    return 0;
-}
-
-int main(void)
-{
-    // time_check(test());
+    bench_main("ordered", argc, argv);
 #ifdef ANALYSIS_OPS
-    int times = 10;
-    for (int i = 0;i < times;i++) {
-        test();
-        tid_v_base = 0;
-    }
     analysis_func();
-#else
-    test();
+#endif
+#ifdef LATENCY_OPS
+    latency_report();
 #endif
     return 0;
 }
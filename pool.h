@@ -0,0 +1,257 @@
+/*
+ * Fixed-size object pool. Objects are carved out of cache-line aligned
+ * slabs and kept on a free list per thread slot, so allocation and the
+ * delete function called by the hazard pointer scan do not go through
+ * malloc. A thread whose free list grows too long spills a batch of
+ * objects to the global depot, and a thread that runs dry refills from
+ * the depot before it allocates a new slab.
+ *
+ * With HP_NUMA there is a depot per node. A slab is bound to the node of
+ * the thread that allocates it, and is a power of two bytes aligned on
+ * its size, with its node in its first cache line. pool_free() finds the
+ * node of an object from its address, an object of a remote node is
+ * batched and goes back to the depot of that node.
+ */
+
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include "list_hp.h"
+
+#define POOL_SLAB 64 /* objects per slab */
+#define POOL_BATCH 64 /* objects moved between a free list and the depot */
+#define POOL_CACHE_MAX (POOL_BATCH * 4) /* free objects kept by a thread */
+
+typedef struct pool_obj {
+    struct pool_obj *next;
+} pool_obj_t;
+
+typedef struct {
+    alignas(128) pool_obj_t *head;
+    int cnt;
+#ifdef HP_NUMA
+    pool_obj_t *remote[HP_NUMA_NODES]; /* freed objects of other nodes */
+    int nremote[HP_NUMA_NODES];
+#endif
+} pool_cache_t;
+
+#ifdef HP_NUMA
+#define POOL_SLAB_HDR 128 /* the node of the slab */
+#endif
+
+typedef struct pool {
+    size_t objsize;
+    atomic_flag lock; /* protects the depots and the slab list */
+    pool_obj_t *depot[HP_NUMA_NODES];
+#ifdef HP_NUMA
+    size_t slabsize; /* set by the first __pool_grow() */
+#endif
+    void **slabs;
+    int nslabs, capslabs;
+    pool_cache_t cache[HP_MAX_THREADS];
+} pool_t;
+
+#define POOL_INIT(size)                                                        \
+    {                                                                          \
+        .objsize = (size), .lock = ATOMIC_FLAG_INIT                            \
+    }
+
+static inline void __pool_lock(pool_t *pool)
+{
+    while (atomic_flag_test_and_set_explicit(&pool->lock,
+                                             memory_order_acquire))
+        ;
+}
+
+static inline void __pool_unlock(pool_t *pool)
+{
+    atomic_flag_clear_explicit(&pool->lock, memory_order_release);
+}
+
+#ifdef HP_NUMA
+
+/* The smallest power of two, and at least a page so it can be bound,
+ * that holds the header and POOL_SLAB objects.
+ */
+static inline size_t __pool_slabsize(size_t objsize)
+{
+    size_t size = 4096;
+    while (size < POOL_SLAB_HDR + POOL_SLAB * objsize)
+        size <<= 1;
+    return size;
+}
+
+/* The node of the slab 'obj' was carved out of */
+static inline int __pool_node_of(pool_t *pool, void *obj)
+{
+    return *(int *)((uintptr_t)obj & ~(pool->slabsize - 1));
+}
+
+#endif
+
+/* Allocate a new slab on 'node' and push its objects on 'c'. Called with
+ * the lock.
+ */
+static inline void __pool_grow(pool_t *pool, pool_cache_t *c, int node)
+{
+#ifdef HP_NUMA
+    if (!pool->slabsize)
+        pool->slabsize = __pool_slabsize(pool->objsize);
+    size_t size = pool->slabsize;
+    char *slab = aligned_alloc(size, size);
+    assert(slab);
+    // bind it before the objects are linked, which touches every page
+    hp_numa_bind(slab, size, node);
+    *(int *)slab = node;
+    char *objs = slab + POOL_SLAB_HDR;
+    int nobjs = (size - POOL_SLAB_HDR) / pool->objsize;
+#else
+    (void)node;
+    char *slab = aligned_alloc(128, POOL_SLAB * pool->objsize);
+    assert(slab);
+    char *objs = slab;
+    int nobjs = POOL_SLAB;
+#endif
+
+    if (pool->nslabs == pool->capslabs) {
+        pool->capslabs = pool->capslabs ? pool->capslabs * 2 : 16;
+        pool->slabs =
+            realloc(pool->slabs, pool->capslabs * sizeof(pool->slabs[0]));
+        assert(pool->slabs);
+    }
+    pool->slabs[pool->nslabs++] = slab;
+
+    for (int i = nobjs - 1; i >= 0; i--) {
+        pool_obj_t *obj = (pool_obj_t *)(objs + i * pool->objsize);
+        obj->next = c->head;
+        c->head = obj;
+    }
+    c->cnt += nobjs;
+}
+
+static inline void __pool_refill(pool_t *pool, pool_cache_t *c)
+{
+    int node = hp_numa_node();
+    __pool_lock(pool);
+    for (int i = 0; i < POOL_BATCH && pool->depot[node]; i++) {
+        pool_obj_t *obj = pool->depot[node];
+        pool->depot[node] = obj->next;
+        obj->next = c->head;
+        c->head = obj;
+        c->cnt++;
+    }
+    if (!c->head)
+        __pool_grow(pool, c, node);
+    __pool_unlock(pool);
+}
+
+static inline void __pool_spill(pool_t *pool, pool_cache_t *c)
+{
+    int node = hp_numa_node();
+    __pool_lock(pool);
+    for (int i = 0; i < POOL_BATCH; i++) {
+        pool_obj_t *obj = c->head;
+        c->head = obj->next;
+        obj->next = pool->depot[node];
+        pool->depot[node] = obj;
+    }
+    c->cnt -= POOL_BATCH;
+    __pool_unlock(pool);
+}
+
+#ifdef HP_NUMA
+
+/* Hand the objects of 'node' that 'c' collected back to its depot */
+static inline void __pool_spill_remote(pool_t *pool, pool_cache_t *c, int node)
+{
+    pool_obj_t *first = c->remote[node], *last = first;
+    while (last->next)
+        last = last->next;
+    __pool_lock(pool);
+    last->next = pool->depot[node];
+    pool->depot[node] = first;
+    __pool_unlock(pool);
+    c->remote[node] = NULL;
+    c->nremote[node] = 0;
+}
+
+#endif
+
+/* Threads that are not attached to any hazard pointer domain have no slot,
+ * they go straight to the depot.
+ */
+static inline void *pool_alloc(pool_t *pool)
+{
+    pool_obj_t *obj;
+
+    if (tid_v == TID_UNKNOWN) {
+        pool_cache_t c = { .head = NULL, .cnt = 0 };
+        int node = hp_numa_node();
+        __pool_lock(pool);
+        if (!pool->depot[node]) {
+            __pool_grow(pool, &c, node);
+            pool->depot[node] = c.head;
+        }
+        obj = pool->depot[node];
+        pool->depot[node] = obj->next;
+        __pool_unlock(pool);
+        return obj;
+    }
+
+    pool_cache_t *c = &pool->cache[tid_v];
+    if (!c->head)
+        __pool_refill(pool, c);
+    obj = c->head;
+    c->head = obj->next;
+    c->cnt--;
+    return obj;
+}
+
+static inline void pool_free(pool_t *pool, void *ptr)
+{
+    pool_obj_t *obj = ptr;
+#ifdef HP_NUMA
+    int node = __pool_node_of(pool, obj);
+#else
+    int node = 0;
+#endif
+
+    if (tid_v == TID_UNKNOWN) {
+        __pool_lock(pool);
+        obj->next = pool->depot[node];
+        pool->depot[node] = obj;
+        __pool_unlock(pool);
+        return;
+    }
+
+    pool_cache_t *c = &pool->cache[tid_v];
+#ifdef HP_NUMA
+    if (node != tid_node[tid_v]) {
+        obj->next = c->remote[node];
+        c->remote[node] = obj;
+        if (++c->nremote[node] == POOL_BATCH)
+            __pool_spill_remote(pool, c, node);
+        return;
+    }
+#endif
+    obj->next = c->head;
+    c->head = obj;
+    if (++c->cnt > POOL_CACHE_MAX)
+        __pool_spill(pool, c);
+}
+
+/* Release every slab. No object of the pool may be in use. */
+static inline void pool_destroy(pool_t *pool)
+{
+    for (int i = 0; i < pool->nslabs; i++)
+        free(pool->slabs[i]);
+    free(pool->slabs);
+    pool->slabs = NULL;
+    pool->nslabs = pool->capslabs = 0;
+    for (int i = 0; i < HP_NUMA_NODES; i++)
+        pool->depot[i] = NULL;
+    for (int i = 0; i < HP_MAX_THREADS; i++)
+        pool->cache[i] = (pool_cache_t){ .head = NULL, .cnt = 0 };
+}
+
+#endif /* __POOL_H__ */
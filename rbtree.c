@@ -127,23 +127,122 @@ void rbtree_insert(struct task_tree_root *root,
 
 #define rb_free_function_prototype(name, rbnode) void name(struct rbtree *node)
 
-static inline void _rbtree_clean(struct task_tree_root *root,
-                                 struct rbtree *node,
-                                 void (*freefunc)(struct rbtree *))
+/*
+ * Unlink the smallest node without recursion and without a stack: the left
+ * child of the head is rotated up until there is none, then the head is
+ * the smallest node and its right subtree becomes the rest. Each node is
+ * rotated up at most once, so draining a tree is O(n).
+ */
+struct rbtree *rbtree_drain_next(struct task_tree_root *root)
 {
-    if (node != &root->nil) {
+    struct rbtree *node = root->head;
+
+    if (node == &root->nil) {
+        root->cnt = 0;
+        return NULL;
+    }
+    while (node->leftC != &root->nil) {
         struct rbtree *left = node->leftC;
-        struct rbtree *right = node->rightC;
-        freefunc(node);
-        _rbtree_clean(root, left, freefunc);
-        _rbtree_clean(root, right, freefunc);
+        node->leftC = left->rightC;
+        left->rightC = node;
+        node = left;
     }
+    root->head = node->rightC;
+    root->cnt--;
+    return node;
 }
 
 void rbtree_clean(struct task_tree_root *root,
-                                void (*freefunc)(struct rbtree *))
+                  void (*freefunc)(struct rbtree *))
 {
-    _rbtree_clean(root, root->head, freefunc);
+    struct rbtree *node;
+
+    while ((node = rbtree_drain_next(root)))
+        freefunc(node);
+}
+
+/*
+ * Build the subtree of the next 'n' nodes of the chain '*list', linked in
+ * ascending order through rightC, and advance '*list' past them. The
+ * middle node is the root, so the two halves differ by at most one node,
+ * and every nil is at depth 'reddepth' or 'reddepth + 1'. Nodes at depth
+ * 'reddepth' are red and the others black, which gives every path the
+ * same number of black nodes.
+ */
+static struct rbtree *__rbtree_build(struct task_tree_root *root,
+                                     struct rbtree **list, size_t n,
+                                     struct rbtree *parent, int depth,
+                                     int reddepth)
+{
+    if (n == 0)
+        return &root->nil;
+
+    struct rbtree *left =
+        __rbtree_build(root, list, n / 2, NULL, depth + 1, reddepth);
+    struct rbtree *node = *list;
+    *list = node->rightC;
+
+    node->leftC = left;
+    if (left != &root->nil)
+        rb_set_parent(left, node);
+    node->rightC =
+        __rbtree_build(root, list, n - n / 2 - 1, node, depth + 1, reddepth);
+    node->parent_color = (unsigned long)parent;
+    if (depth == reddepth)
+        rb_set_red(node);
+    else
+        rb_set_black(node);
+    return node;
+}
+
+/* Depth of the deepest level of a tree of 'n' nodes built as above */
+static inline int __rbtree_build_depth(size_t n)
+{
+    int depth = -1;
+    for (; n; n >>= 1)
+        depth++;
+    return depth;
+}
+
+/* Replace the tree with the 'n' nodes of the chain 'list' */
+static void __rbtree_build_list(struct task_tree_root *root,
+                                struct rbtree *list, size_t n)
+{
+    root->head = __rbtree_build(root, &list, n, &root->nil, 0,
+                                __rbtree_build_depth(n));
+    if (n)
+        rb_set_black(root->head);
+    root->cnt = n;
+}
+
+void rbtree_build_sorted(struct task_tree_root *root, struct rbtree **nodes,
+                         size_t n)
+{
+    for (size_t i = 0; i + 1 < n; i++)
+        nodes[i]->rightC = nodes[i + 1];
+    __rbtree_build_list(root, n ? nodes[0] : NULL, n);
+}
+
+size_t rbtree_delete_if(struct task_tree_root *root,
+                        int (*keep)(struct rbtree *, void *),
+                        void (*deletefunc)(struct rbtree *, void *), void *arg)
+{
+    struct rbtree *node, *list = NULL, **tail = &list;
+    size_t kept = 0, deleted = 0;
+
+    // drain in order and chain the nodes we keep through rightC
+    while ((node = rbtree_drain_next(root))) {
+        if (keep(node, arg)) {
+            *tail = node;
+            tail = &node->rightC;
+            kept++;
+        } else {
+            deletefunc(node, arg);
+            deleted++;
+        }
+    }
+    __rbtree_build_list(root, list, kept);
+    return deleted;
 }
 
 struct rbtree *rbtree_search(struct task_tree_root *root,
@@ -249,6 +348,50 @@ struct rbtree *task_tree_max(struct task_tree_root *root,
     return x;
 }
 
+struct rbtree *rbtree_first(struct task_tree_root *root)
+{
+    if (root->head == &root->nil)
+        return NULL;
+    return task_tree_min(root, root->head);
+}
+
+struct rbtree *rbtree_last(struct task_tree_root *root)
+{
+    if (root->head == &root->nil)
+        return NULL;
+    return task_tree_max(root, root->head);
+}
+
+struct rbtree *rbtree_successor(struct task_tree_root *root,
+                                struct rbtree *node)
+{
+    if (node->rightC != &root->nil)
+        return task_tree_min(root, node->rightC);
+
+    // climb until we come up from a left subtree
+    struct rbtree *parent = rb_parent(node);
+    while (parent != &root->nil && node == parent->rightC) {
+        node = parent;
+        parent = rb_parent(parent);
+    }
+    return parent == &root->nil ? NULL : parent;
+}
+
+struct rbtree *rbtree_predecessor(struct task_tree_root *root,
+                                  struct rbtree *node)
+{
+    if (node->leftC != &root->nil)
+        return task_tree_max(root, node->leftC);
+
+    // climb until we come up from a right subtree
+    struct rbtree *parent = rb_parent(node);
+    while (parent != &root->nil && node == parent->leftC) {
+        node = parent;
+        parent = rb_parent(parent);
+    }
+    return parent == &root->nil ? NULL : parent;
+}
+
 static inline void task_tree_transplant(struct task_tree_root *root,
                                         struct rbtree *u, struct rbtree *v)
 {
@@ -71,9 +71,7 @@ struct task_tree_root {
 
 #define rb_set_color(d, s)                                                     \
     do {                                                                       \
-        struct rbtree __tmp = *(s);                                            \
-        __tmp.parent_color |= (unsigned long)~1;                               \
-        (d)->parent_color &= __tmp.parent_color;                               \
+        (d)->parent_color = ((d)->parent_color & ~1UL) | rb_color(s);          \
     } while (0)
 
 #define RB_ROOT_INIT(root)                                                     \
@@ -88,36 +86,35 @@ struct task_tree_root {
 struct rbtree *task_tree_min(struct task_tree_root *root, struct rbtree *x);
 struct rbtree *task_tree_max(struct task_tree_root *root, struct rbtree *x);
 
+/*
+ * In-order iteration: the smallest (largest) node, and the node after
+ * (before) 'node'. They return NULL past either end or on an empty tree,
+ * and the tree must not be modified while it is iterated.
+ *
+ *     for (n = rbtree_first(root); n; n = rbtree_successor(root, n))
+ */
+struct rbtree *rbtree_first(struct task_tree_root *root);
+struct rbtree *rbtree_last(struct task_tree_root *root);
+struct rbtree *rbtree_successor(struct task_tree_root *root,
+                                struct rbtree *node);
+struct rbtree *rbtree_predecessor(struct task_tree_root *root,
+                                  struct rbtree *node);
+
+/* Same as rbtree_successor() and rbtree_predecessor(), but they return
+ * the nil node of the tree past either end.
+ */
 #define rbtree_next(r, n)                                                      \
     ({                                                                         \
         struct task_tree_root *__r = r;                                        \
-        struct rbtree *__tmp, *__n = n;                                        \
-        if (__n->rightC != NULL)                                               \
-            __tmp = task_tree_min(r, __n->rightC);                             \
-        else {                                                                 \
-            __tmp = rb_parent(n);                                              \
-            while (__tmp != &__r->nil && __n == __tmp->rightC) {               \
-                __n = __tmp;                                                   \
-                __tmp = rb_parent(__tmp);                                      \
-            }                                                                  \
-        }                                                                      \
-        __tmp;                                                                 \
+        struct rbtree *__tmp = rbtree_successor(__r, n);                       \
+        __tmp ? __tmp : &__r->nil;                                             \
     })
 
 #define rbtree_prev(r, n)                                                      \
     ({                                                                         \
         struct task_tree_root *__r = r;                                        \
-        struct rbtree *__tmp, *__n = n;                                        \
-        if (__n->leftC != NULL)                                                \
-            __tmp = task_tree_max(r, __n->leftC);                              \
-        else {                                                                 \
-            __tmp = rb_parent(n);                                              \
-            while (__tmp != &__r->nil && __n == __tmp->leftC) {                \
-                __n = __tmp;                                                   \
-                __tmp = rb_parent(__tmp);                                      \
-            }                                                                  \
-        }                                                                      \
-        __tmp;                                                                 \
+        struct rbtree *__tmp = rbtree_predecessor(__r, n);                     \
+        __tmp ? __tmp : &__r->nil;                                             \
     })
 
 /*
@@ -129,9 +126,37 @@ struct rbtree *task_tree_max(struct task_tree_root *root, struct rbtree *x);
 void rbtree_insert(struct task_tree_root *root, struct rbtree *node,
                    int (*cmp)(struct rbtree *, struct rbtree *));
 
+/*
+ * Unlink and return the smallest node, or NULL once the tree is empty.
+ * Draining does not rebalance: once started, the tree may only be drained
+ * until it is empty (or reset with RB_ROOT_INIT).
+ */
+struct rbtree *rbtree_drain_next(struct task_tree_root *root);
+
+/*
+ * Call freefunc on every node in ascending order and leave the tree empty.
+ */
 void rbtree_clean(struct task_tree_root *root,
                   void (*freefunc)(struct rbtree *));
 
+/*
+ * Replace the content of 'root' with the 'n' nodes of 'nodes', which have
+ * to be in ascending order. The tree is balanced and colored in O(n),
+ * without a rotation.
+ */
+void rbtree_build_sorted(struct task_tree_root *root, struct rbtree **nodes,
+                         size_t n);
+
+/*
+ * Remove every node for which keep() returns 0 and pass it to deletefunc,
+ * in one pass over the tree, then rebuild the tree with the nodes left as
+ * rbtree_build_sorted() does. 'arg' is passed to both. Returns the number
+ * of nodes deleted.
+ */
+size_t rbtree_delete_if(struct task_tree_root *root,
+                        int (*keep)(struct rbtree *, void *),
+                        void (*deletefunc)(struct rbtree *, void *), void *arg);
+
 /*
  * The return value must in RB_EQUAL, RB_LEFT, RB_RIGHT, RB_EQUAL_BREAK.
  */
@@ -39,6 +39,76 @@ rb_delete_function_prototype(delete, __n)
     free(n);
 }
 
+/* Check the red-black properties, returns the black height */
+static int rb_check(struct task_tree_root *root, struct rbtree *n,
+                    struct rbtree *parent)
+{
+    if (n == &root->nil)
+        return 1;
+    assert(rb_parent(n) == parent);
+    if (rb_is_red(n))
+        assert(rb_is_black(n->leftC) && rb_is_black(n->rightC));
+    int l = rb_check(root, n->leftC, n);
+    int r = rb_check(root, n->rightC, n);
+    assert(l == r);
+    return l + rb_is_black(n);
+}
+
+static int keep_even(struct rbtree *n, void *arg)
+{
+    (void)arg;
+    return container_of(n, struct test_node, node)->value % 2 == 0;
+}
+
+static void delete_arg(struct rbtree *n, void *arg)
+{
+    (*(int *)arg)++;
+    free(container_of(n, struct test_node, node));
+}
+
+static void test_bulk(void)
+{
+    struct rbtree *nodes[300];
+
+    for (int n = 0; n <= 300; n++) {
+        struct task_tree_root root;
+        RB_ROOT_INIT(root);
+        for (int i = 0; i < n; i++) {
+            struct test_node *t = malloc(sizeof(*t));
+            t->value = i;
+            nodes[i] = &t->node;
+        }
+        rbtree_build_sorted(&root, nodes, n);
+        assert(root.cnt == (size_t)n);
+        assert(rb_is_black(root.head));
+        rb_check(&root, root.head, &root.nil);
+
+        int deleted = 0;
+        assert(rbtree_delete_if(&root, keep_even, delete_arg, &deleted) ==
+               (size_t)n / 2);
+        assert(deleted == n / 2 && root.cnt == (size_t)(n - n / 2));
+        rb_check(&root, root.head, &root.nil);
+        int last = -2;
+        for (struct rbtree *it = rbtree_first(&root); it;
+             it = rbtree_successor(&root, it)) {
+            int v = container_of(it, struct test_node, node)->value;
+            assert(v == last + 2);
+            last = v;
+        }
+
+        // the rebuilt tree is still a tree we can insert into
+        for (int i = 1; i < n; i += 2) {
+            struct test_node *t = malloc(sizeof(*t));
+            t->value = i;
+            rbtree_insert(&root, &t->node, cmp_insert);
+        }
+        assert(root.cnt == (size_t)n);
+        rb_check(&root, root.head, &root.nil);
+        rbtree_clean(&root, delete);
+    }
+    printf("bulk ok\n");
+}
+
 int main(void)
 {
     struct task_tree_root root;
@@ -69,6 +139,22 @@ int main(void)
     printf("search %d\n", tmp->value);
     printf("prev %d\n", container_of(rbtree_prev(&root, n), struct test_node, node)->value);
     printf("next %d\n", container_of(rbtree_next(&root, n), struct test_node, node)->value);
+
+    size_t cnt = 0;
+    int last = -1;
+    for (n = rbtree_first(&root); n; n = rbtree_successor(&root, n)) {
+        tmp = container_of(n, struct test_node, node);
+        assert(tmp->value > last);
+        last = tmp->value;
+        cnt++;
+    }
+    assert(cnt == root.cnt);
+    for (n = rbtree_last(&root); n; n = rbtree_predecessor(&root, n))
+        cnt--;
+    assert(cnt == 0);
+    printf("iterated %zu\n", root.cnt);
+
+    test_bulk();
     
     rbtree_clean(&root, delete);
 
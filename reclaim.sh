@@ -0,0 +1,24 @@
+# Compare the reclamation backends, fence modes and reclaimers of list_hp.h.
+# usage: bash reclaim.sh [bench options]
+
+CONFIGS="HAZARD:SYMMETRIC:INLINE HAZARD:ASYMMETRIC:INLINE
+         HAZARD:SYMMETRIC:BACKGROUND EPOCH:SYMMETRIC:INLINE
+         EPOCH:ASYMMETRIC:INLINE EPOCH:SYMMETRIC:BACKGROUND"
+ARGS=${@:--t 8 -s 0.5}
+
+for config in $CONFIGS; do
+    IFS=: read backend fence reclaim <<< "$config"
+    echo "## $backend, $fence fence, $reclaim reclaim"
+    for src in list ordered orderedv2 skiplist hashset; do
+        gcc -O2 -D NDEBUG -D HP_BACKEND=HP_BACKEND_$backend \
+            -D HP_FENCE=HP_FENCE_$fence -D HP_RECLAIM=HP_RECLAIM_$reclaim \
+            -Wall -o reclaim_bench $src.c -lpthread -lm
+        ./reclaim_bench $ARGS | awk -v src=$src '
+            /ops\/sec/ { getline; ops = $2 }
+            /^reclaim/ { peak = $5 }
+            END { printf "%-10s %14s ops/sec %10s unreclaimed\n", src, ops, peak }'
+    done
+    echo ""
+done
+
+rm -f reclaim_bench
@@ -1,50 +1,111 @@
-YES="Y"
-yes="y"
+# Run the benchmark matrix, variant x reclamation policy x threads x mix,
+# and write one CSV row per configuration. Throughput, perf counters and
+# peak memory come from a -O2 -D NDEBUG build, the latency percentiles
+# from a second run built with -D LATENCY_OPS, so taking them does not
+# slow down the throughput run.
+#
+# usage: bash script.sh [out.csv]
+#
+# The matrix is set from the environment:
+#   IMPLS      variants (list ordered orderedv2 vrb_list vrb_listv1)
+#   POLICIES   backend:fence:reclaim of list_hp.h, as in reclaim.sh. The
+#              vrb variants have their own hazard pointers, they only run
+#              once, with policy "own".
+#   THREADS    thread counts (1 2 4 8)
+#   MIXES      insert:delete:lookup mixes (50:50:0 25:25:50 5:5:90), the
+#              vrb variants skip the ones with lookups
+#   SECS       seconds per run (0.5), ARGS more bench options
+#   RUNS       throughput runs per configuration (3), the median is kept
+#   BASELINE   CSV of an earlier run, baseline.csv if it exists. The deltas
+#              against it are printed, and the script fails when a
+#              throughput regressed by more than THRESHOLD percent (5).
+#
+# The plots are written to <out>.plots/, see statistic.py.
 
-read -p "analyze [Y/N] " ANAL
-read -p "perf    [Y/N] " PERF
+OUT=${1:-bench.csv}
+IMPLS=${IMPLS:-list ordered orderedv2 vrb_list vrb_listv1}
+POLICIES=${POLICIES:-HAZARD:SYMMETRIC:INLINE EPOCH:SYMMETRIC:INLINE HAZARD:ASYMMETRIC:INLINE HAZARD:SYMMETRIC:BACKGROUND}
+THREADS=${THREADS:-1 2 4 8}
+MIXES=${MIXES:-50:50:0 25:25:50 5:5:90}
+SECS=${SECS:-0.5}
+RUNS=${RUNS:-3}
+THRESHOLD=${THRESHOLD:-5}
+[ -z "$BASELINE" ] && [ -f baseline.csv ] && BASELINE=baseline.csv
 
-if [ $ANAL == $YES ] || [ $ANAL == $yes ]
-then
-    CFLAG='-D ANALYSIS_OPS'
-else
-    CFLAG=''
-fi
-
-if [ $PERF == $YES ]  || [ $PERF == $yes ]
-then 
-    PERF_COM='sudo perf stat --repeat 1000 -e cache-misses,cache-references,instructions,cycles'
-else
-    PERF_COM=''
-fi
-
-#########################
+set -e
 
-echo "## default list"
-gcc ${CFLAG} -Wall -o list list.c -lpthread -g
-$PERF_COM ./list
-echo ""
+CFLAGS="-O2 -D NDEBUG -Wall"
 
-##########################
+# build <impl> <policy> <binary> [flags]
+build() {
+    local impl=$1 policy=$2 bin=$3
+    shift 3
+    case $impl in
+    vrb_*)
+        gcc $CFLAGS "$@" -o $bin $impl.c rbtree.c -lpthread -lm
+        ;;
+    *)
+        IFS=: read backend fence reclaim <<< "$policy"
+        gcc $CFLAGS "$@" -D HP_BACKEND=HP_BACKEND_$backend \
+            -D HP_FENCE=HP_FENCE_$fence -D HP_RECLAIM=HP_RECLAIM_$reclaim \
+            -o $bin $impl.c -lpthread -lm
+        ;;
+    esac
+}
 
-echo "## ordered list v1"
-gcc $CFLAG -Wall -o ordered ordered.c -lpthread -g
-$PERF_COM ./ordered
-echo ""
+# The fields of a throughput run, in the order of the CSV
+parse_run() {
+    awk '
+        function na(v) { return v == "n/a" ? "" : v }
+        /ops\/sec/ { getline; ops = $2; insns = $3; cycles = $4; misses = $5; rss = $6 }
+        /^reclaim/ { peak = $5 }
+        END { printf "%s,%s,%s,%s,%s,%s", ops, na(insns), na(cycles), na(misses), rss, peak }'
+}
 
-##########################
+# p50, p99 and p99.9 of every histogram of a latency run
+parse_lat() {
+    awk '
+        $1 == "insert" || $1 == "delete" || $1 == "contains" { p[$1] = $3 "," $4 "," $5 }
+        $1 == "hp" && $2 == "scan" { p["scan"] = $4 "," $5 "," $6 }
+        END {
+            split("insert delete contains scan", h, " ")
+            for (i = 1; i <= 4; i++)
+                printf "%s%s", (h[i] in p ? p[h[i]] : ",,"), (i < 4 ? "," : "")
+        }'
+}
 
-echo "## ordered list v2"
-gcc $CFLAG -Wall -o orderedv2 orderedv2.c -lpthread -g
-$PERF_COM ./orderedv2
-echo ""
+echo "impl,policy,threads,mix,ops_per_sec,insns_per_op,cycles_per_op,misses_per_op,maxrss_kb,peak_unreclaimed,insert_p50,insert_p99,insert_p999,delete_p50,delete_p99,delete_p999,contains_p50,contains_p99,contains_p999,scan_p50,scan_p99,scan_p999" > $OUT
 
+for impl in $IMPLS; do
+    case $impl in
+    vrb_*) policies=own ;;
+    *) policies=$POLICIES ;;
+    esac
+    for policy in $policies; do
+        build $impl $policy matrix_bench
+        build $impl $policy matrix_lat -D LATENCY_OPS
+        for mix in $MIXES; do
+            case $impl:$mix in
+            vrb_*:*:*:0) ;;
+            vrb_*) continue ;;
+            esac
+            for t in $THREADS; do
+                opts="-t $t -m $mix -s $SECS $ARGS"
+                run=$(for i in $(seq $RUNS); do
+                    ./matrix_bench $opts | parse_run
+                    echo
+                done | sort -t, -k1 -g | sed -n "$(((RUNS + 1) / 2))p")
+                lat=$(./matrix_lat $opts | parse_lat)
+                echo "$impl,$policy,$t,$mix,$run,$lat" >> $OUT
+                echo "$impl $policy -t $t -m $mix: $(echo $run | cut -d, -f1) ops/sec"
+            done
+        done
+    done
+done
 
-rm -f list ordered orderedv2
+rm -f matrix_bench matrix_lat
 
-
-#gcc -Wall -o vrb_list vrb_list.c -lpthread -g
-#for i in {1..10}; do echo -ne "$i ";  ./vrb_list;  done
-
-#for i in {1..1000}; do echo -ne "$i ";  ./list;  done
-# -fsanitize=thread
+python3 statistic.py plot $OUT ${OUT%.csv}.plots
+if [ -n "$BASELINE" ]; then
+    python3 statistic.py compare $BASELINE $OUT $THRESHOLD
+fi
@@ -0,0 +1,347 @@
+/*
+ * Lock-free skip list on the hazard pointer domain of list_hp.h.
+ *
+ * Every level is a Harris-Michael list of its own: a node is deleted from
+ * a level by marking its next pointer of that level, and is unlinked from
+ * it by whichever find passes over it. The mark of level 0 is the one that
+ * decides which delete removes the key. The levels are marked top-down
+ * and linked bottom-up, so a node that is linked at level i is linked at
+ * every level below as well.
+ */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#include "analysis.h"
+#include "latency.h"
+#include "list_hp.h"
+#include "list_node.h"
+#include "pool.h"
+
+#ifdef ANALYSIS_OPS
+
+void analysis_func(void)
+{
+    printf("%10s %10s %10s %10s %10s %10s %10s %10s\n", "rtry", "cons", "trav",
+           "fail", "del", "ins", "deletes", "inserts");
+    for (int i = 0; i < 87; i++)
+        printf("-");
+    printf("\n");
+    for (int i = 0; i < ST_NR_OPS; i++)
+        printf("%10" PRIu64 "%c", analysis_sum(i),
+               i == ST_NR_OPS - 1 ? '\n' : ' ');
+    list_hp_analysis();
+    analysis_breakdown();
+}
+
+#endif
+
+#include <pthread.h>
+
+/* A node gets one more level with probability 1/4, so 16 levels keep the
+ * search logarithmic up to 4^16 keys.
+ */
+#define SL_MAX_LEVEL 16
+
+/* Every level holds its pred and its curr in hazard pointers of its own,
+ * so the nodes around key stay protected at all levels when find returns.
+ * The find moves curr to pred, then overwrites curr: curr has the lower
+ * slot, which the scans read first, or a scan in between could miss the
+ * node in both (see HP_SCAN in list_hp.h).
+ */
+#define HP_CURR(i) (2 * (i))
+#define HP_PRED(i) (2 * (i) + 1)
+#define SL_HPS (2 * SL_MAX_LEVEL)
+
+#define is_marked(p) (bool)((uintptr_t)(p)&0x01)
+#define get_marked(p) ((uintptr_t)(p) | (0x01))
+#define get_unmarked(p) ((uintptr_t)(p) & (~0x01))
+
+#define get_unmarked_node(p) ((sl_node_t *)get_unmarked(p))
+
+typedef struct sl_node {
+    list_key_t key;
+    int height;
+    /* The inserter and the deleter of a node both hold a reference, the
+     * last one to drop it retires the node. The inserter may still be
+     * linking the upper levels when the deleter has unlinked the others.
+     */
+    atomic_int refs;
+    atomic_uintptr_t next[];
+} sl_node_t;
+
+typedef struct skiplist {
+    sl_node_t *head, *tail;
+    list_hp_t *hp;
+} skiplist_t;
+
+#define SL_NODE_SIZE(h) (sizeof(sl_node_t) + (h) * sizeof(atomic_uintptr_t))
+
+/* One pool per height, nodes are recycled by the thread that frees them */
+static pool_t node_pool[SL_MAX_LEVEL] = {
+    POOL_INIT(SL_NODE_SIZE(1)),  POOL_INIT(SL_NODE_SIZE(2)),
+    POOL_INIT(SL_NODE_SIZE(3)),  POOL_INIT(SL_NODE_SIZE(4)),
+    POOL_INIT(SL_NODE_SIZE(5)),  POOL_INIT(SL_NODE_SIZE(6)),
+    POOL_INIT(SL_NODE_SIZE(7)),  POOL_INIT(SL_NODE_SIZE(8)),
+    POOL_INIT(SL_NODE_SIZE(9)),  POOL_INIT(SL_NODE_SIZE(10)),
+    POOL_INIT(SL_NODE_SIZE(11)), POOL_INIT(SL_NODE_SIZE(12)),
+    POOL_INIT(SL_NODE_SIZE(13)), POOL_INIT(SL_NODE_SIZE(14)),
+    POOL_INIT(SL_NODE_SIZE(15)), POOL_INIT(SL_NODE_SIZE(16)),
+};
+
+static thread_local uint64_t sl_seed = 0;
+
+/* Height of a new node, 1 + the number of leading 1/4 coin flips won */
+static int __sl_random_height(void)
+{
+    if (!sl_seed)
+        sl_seed = (uintptr_t)&sl_seed | 1;
+    // xorshift64
+    sl_seed ^= sl_seed << 13;
+    sl_seed ^= sl_seed >> 7;
+    sl_seed ^= sl_seed << 17;
+
+    uint64_t r = sl_seed;
+    int height = 1;
+    while ((r & 3) == 0 && height < SL_MAX_LEVEL) {
+        height++;
+        r >>= 2;
+    }
+    return height;
+}
+
+sl_node_t *sl_node_new(list_key_t key, int height)
+{
+    sl_node_t *node = pool_alloc(&node_pool[height - 1]);
+    assert(node);
+    node->key = key;
+    node->height = height;
+    atomic_init(&node->refs, 2);
+    for (int i = 0; i < height; i++)
+        atomic_init(&node->next[i], 0);
+    inserts_inc;
+    return node;
+}
+
+void sl_node_destroy(sl_node_t *node)
+{
+    if (!node)
+        return;
+    pool_free(&node_pool[node->height - 1], node);
+    deletes_inc;
+}
+
+static void __sl_node_delete(void *arg)
+{
+    sl_node_t *node = (sl_node_t *)arg;
+    sl_node_destroy(node);
+}
+
+static inline void __sl_node_unref(skiplist_t *sl, sl_node_t *node)
+{
+    if (atomic_fetch_sub(&node->refs, 1) == 1)
+        list_hp_retire(sl->hp, (uintptr_t)node);
+}
+
+/*
+ * Find the nodes around key at every level, preds[i]->key < key <=
+ * succs[i]->key, unlinking every marked node on the way. Both are left
+ * protected by the hazard pointers of their level.
+ *
+ * curr is only used once pred has been seen unmarked and still pointing
+ * to it after curr got protected: pred is linked then, so curr is too and
+ * cannot have been retired.
+ */
+static bool __sl_find(skiplist_t *sl, list_key_t key, sl_node_t **preds,
+                      sl_node_t **succs)
+{
+    sl_node_t *pred, *curr;
+
+try_again:
+    pred = sl->head;
+    for (int i = SL_MAX_LEVEL - 1; i >= 0; i--) {
+        // pred is still protected by the level above
+        (void)list_hp_protect_release(sl->hp, HP_PRED(i), (uintptr_t)pred);
+        while (true) {
+            uintptr_t c = atomic_load(&pred->next[i]);
+            // pred got deleted from this level
+            if (is_marked(c))
+                goto_try_again;
+            (void)list_hp_protect_ptr(sl->hp, HP_CURR(i), c);
+            if (atomic_load(&pred->next[i]) != c)
+                continue;
+            curr = (sl_node_t *)c;
+
+            uintptr_t next = atomic_load(&curr->next[i]);
+            if (is_marked(next)) {
+                cons_inc;
+                uintptr_t tmp = c;
+                if (!CAS(&pred->next[i], &tmp, get_unmarked(next)))
+                    goto_try_again;
+                continue;
+            }
+            if (!(curr->key < key)) {
+                preds[i] = pred;
+                succs[i] = curr;
+                break;
+            }
+            (void)list_hp_protect_release(sl->hp, HP_PRED(i), c);
+            pred = curr;
+            trav_inc;
+        }
+    }
+    return succs[0]->key == key;
+}
+
+bool skiplist_insert(skiplist_t *sl, list_key_t key)
+{
+    sl_node_t *preds[SL_MAX_LEVEL], *succs[SL_MAX_LEVEL];
+    sl_node_t *node = NULL;
+    latency_scope(LAT_INSERT);
+
+    while (true) {
+        if (__sl_find(sl, key, preds, succs)) {
+            sl_node_destroy(node);
+            list_hp_clear(sl->hp);
+            return false;
+        }
+
+        // only allocate once we know the key is absent
+        if (!node)
+            node = sl_node_new(key, __sl_random_height());
+        for (int i = 0; i < node->height; i++)
+            atomic_store_explicit(&node->next[i], (uintptr_t)succs[i],
+                                  memory_order_relaxed);
+        uintptr_t tmp = (uintptr_t)succs[0];
+        if (CAS(&preds[0]->next[0], &tmp, (uintptr_t)node))
+            break;
+        ins_inc;
+    }
+
+    // key is in the set now, link the upper levels
+    for (int i = 1; i < node->height; i++) {
+        while (true) {
+            uintptr_t next = atomic_load(&node->next[i]);
+            // stop as soon as a delete has started
+            if (is_marked(next))
+                goto out;
+            if (next != (uintptr_t)succs[i] &&
+                !CAS(&node->next[i], &next, (uintptr_t)succs[i]))
+                goto out;
+            uintptr_t tmp = (uintptr_t)succs[i];
+            if (CAS(&preds[i]->next[i], &tmp, (uintptr_t)node))
+                break;
+            ins_inc;
+            (void)__sl_find(sl, key, preds, succs);
+        }
+    }
+
+out:
+    // A delete may have unlinked the node before we linked a level, make
+    // sure it is off every level before the reference is dropped.
+    if (is_marked(atomic_load(&node->next[0])))
+        (void)__sl_find(sl, key, preds, succs);
+    list_hp_clear(sl->hp);
+    __sl_node_unref(sl, node);
+    return true;
+}
+
+bool skiplist_delete(skiplist_t *sl, list_key_t key)
+{
+    sl_node_t *preds[SL_MAX_LEVEL], *succs[SL_MAX_LEVEL];
+    latency_scope(LAT_DELETE);
+
+    if (!__sl_find(sl, key, preds, succs)) {
+        list_hp_clear(sl->hp);
+        return false;
+    }
+
+    sl_node_t *node = succs[0];
+    for (int i = node->height - 1; i > 0; i--)
+        (void)atomic_fetch_or(&node->next[i], 0x01);
+
+    // the thread that marks level 0 is the one deleting key
+    if (is_marked(atomic_fetch_or(&node->next[0], 0x01))) {
+        del_inc;
+        list_hp_clear(sl->hp);
+        return false;
+    }
+
+    // unlink it from every level
+    (void)__sl_find(sl, key, preds, succs);
+    list_hp_clear(sl->hp);
+    __sl_node_unref(sl, node);
+    return true;
+}
+
+bool skiplist_contains(skiplist_t *sl, list_key_t key)
+{
+    sl_node_t *preds[SL_MAX_LEVEL], *succs[SL_MAX_LEVEL];
+    latency_scope(LAT_CONTAINS);
+
+    bool found = __sl_find(sl, key, preds, succs);
+    list_hp_clear(sl->hp);
+    return found;
+}
+
+skiplist_t *skiplist_new(void)
+{
+    skiplist_t *sl = calloc(1, sizeof(*sl));
+    assert(sl);
+    sl_node_t *head = sl_node_new(0, SL_MAX_LEVEL);
+    sl_node_t *tail = sl_node_new(UINTPTR_MAX, SL_MAX_LEVEL);
+    list_hp_t *hp = list_hp_new(SL_HPS, __sl_node_delete);
+    // the mean height of a node is 4/3
+    list_hp_set_objsize(hp, SL_NODE_SIZE(1) + sizeof(atomic_uintptr_t) / 3);
+
+    for (int i = 0; i < SL_MAX_LEVEL; i++)
+        atomic_init(&head->next[i], (uintptr_t)tail);
+    *sl = (skiplist_t){ .head = head, .tail = tail, .hp = hp };
+    return sl;
+}
+
+void skiplist_destroy(skiplist_t *sl)
+{
+    assert(sl);
+    sl_node_t *prev = sl->head;
+    sl_node_t *node = get_unmarked_node(atomic_load(&prev->next[0]));
+    while (node) {
+        sl_node_destroy(prev);
+        prev = node;
+        node = get_unmarked_node(atomic_load(&prev->next[0]));
+    }
+    sl_node_destroy(prev);
+    list_hp_destroy(sl->hp);
+    free(sl);
+}
+
+#define bench_list_t skiplist_t
+#define bench_new skiplist_new
+#define bench_destroy skiplist_destroy
+#define bench_insert skiplist_insert
+#define bench_delete skiplist_delete
+#define bench_contains skiplist_contains
+#define bench_thread_init(sl) list_hp_attach((sl)->hp)
+#define bench_thread_fini(sl) list_hp_detach((sl)->hp)
+#define bench_report(sl) list_hp_report((sl)->hp)
+
+#include "bench.h"
+
+int main(int argc, char *argv[])
+{
+    bench_main("skiplist", argc, argv);
+#ifdef ANALYSIS_OPS
+    analysis_func();
+#endif
+#ifdef LATENCY_OPS
+    latency_report();
+#endif
+    return 0;
+}
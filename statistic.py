@@ -1,10 +1,152 @@
-import numpy
-arr = numpy.loadtxt("array.txt", usecols=range(1,2))
-rb = numpy.loadtxt("rbtree.txt", usecols=range(1,2))
-rbv2 = numpy.loadtxt("rbtreev2.txt", usecols=range(1,2))
+# Plots and regression deltas of the CSV written by script.sh, with the
+# standard library only.
+#
+# usage: python3 statistic.py plot bench.csv outdir
+#        python3 statistic.py compare baseline.csv bench.csv [threshold]
+#
+# plot draws, for every mix, the throughput and the p99 latencies against
+# the thread count, one line per variant and policy, as SVG files.
+#
+# compare prints the throughput and p99 delete latency of every
+# configuration of both files, and exits with 1 if a throughput dropped by
+# more than 'threshold' percent (5 by default).
 
+import csv
+import os
+import sys
 
-print("array mean: {}".format(arr.mean()))
-print("rbtree mean: {}".format(rb.mean()))
-print("rbtree v2 mean: {}".format(rbv2.mean()))
+KEY = ("impl", "policy", "threads", "mix")
+COLORS = ["#1f77b4", "#ff7f0e", "#2ca02c", "#d62728", "#9467bd",
+          "#8c564b", "#e377c2", "#7f7f7f", "#bcbd22", "#17becf"]
 
+
+def load(path):
+    with open(path) as f:
+        return list(csv.DictReader(f))
+
+
+def value(row, col):
+    v = row.get(col, "")
+    return float(v) if v else None
+
+
+def svg_chart(path, title, ylabel, xs, series):
+    """Line chart of series {name: {x: y}} over the categories xs."""
+    w, h, left, right, top, bottom = 720, 420, 80, 220, 40, 50
+    ymax = max([y for s in series.values() for y in s.values()] + [0])
+    ymax = ymax * 1.1 or 1
+    pw, ph = w - left - right, h - top - bottom
+
+    def px(i):
+        return left + (pw * i / (len(xs) - 1) if len(xs) > 1 else pw / 2)
+
+    def py(y):
+        return top + ph - ph * y / ymax
+
+    out = ['<svg xmlns="http://www.w3.org/2000/svg" width="%d" height="%d" '
+           'font-family="sans-serif" font-size="12">' % (w, h),
+           '<rect width="100%" height="100%" fill="white"/>',
+           '<text x="%d" y="20" font-size="14">%s</text>' % (left, title),
+           '<text x="15" y="%d" transform="rotate(-90 15 %d)">%s</text>'
+           % (top + ph / 2, top + ph / 2, ylabel)]
+    for i in range(6):
+        y = ymax * i / 5
+        out.append('<line x1="%d" x2="%d" y1="%.1f" y2="%.1f" stroke="#ddd"/>'
+                   % (left, left + pw, py(y), py(y)))
+        out.append('<text x="%d" y="%.1f" text-anchor="end">%.4g</text>'
+                   % (left - 5, py(y) + 4, y))
+    for i, x in enumerate(xs):
+        out.append('<text x="%.1f" y="%d" text-anchor="middle">%s</text>'
+                   % (px(i), top + ph + 20, x))
+    out.append('<text x="%.1f" y="%d" text-anchor="middle">threads</text>'
+               % (left + pw / 2, h - 8))
+    for n, (name, s) in enumerate(sorted(series.items())):
+        color = COLORS[n % len(COLORS)]
+        pts = ["%.1f,%.1f" % (px(i), py(s[x])) for i, x in enumerate(xs)
+               if x in s]
+        out.append('<polyline fill="none" stroke="%s" stroke-width="2" '
+                   'points="%s"/>' % (color, " ".join(pts)))
+        for p in pts:
+            cx, cy = p.split(",")
+            out.append('<circle cx="%s" cy="%s" r="3" fill="%s"/>'
+                       % (cx, cy, color))
+        ly = top + 16 * n
+        out.append('<rect x="%d" y="%d" width="12" height="12" fill="%s"/>'
+                   % (left + pw + 15, ly, color))
+        out.append('<text x="%d" y="%d">%s</text>'
+                   % (left + pw + 32, ly + 11, name))
+    out.append("</svg>")
+    with open(path, "w") as f:
+        f.write("\n".join(out) + "\n")
+
+
+def plot(csv_path, outdir):
+    rows = load(csv_path)
+    os.makedirs(outdir, exist_ok=True)
+    metrics = [("ops_per_sec", "ops/sec"), ("insert_p99", "insert p99 (ns)"),
+               ("delete_p99", "delete p99 (ns)"),
+               ("contains_p99", "contains p99 (ns)")]
+    for mix in sorted({r["mix"] for r in rows}):
+        mrows = [r for r in rows if r["mix"] == mix]
+        xs = sorted({int(r["threads"]) for r in mrows})
+        for col, label in metrics:
+            series = {}
+            for r in mrows:
+                v = value(r, col)
+                if v is not None:
+                    name = "%s %s" % (r["impl"], r["policy"].lower())
+                    series.setdefault(name, {})[int(r["threads"])] = v
+            if not series:
+                continue
+            path = os.path.join(outdir, "%s-%s.svg"
+                                % (col, mix.replace(":", "-")))
+            svg_chart(path, "%s, mix %s" % (label, mix), label, xs, series)
+            print("wrote %s" % path)
+
+
+def delta(old, new):
+    if old is None or new is None or old == 0:
+        return None
+    return (new - old) / old * 100
+
+
+def compare(base_path, new_path, threshold):
+    base = {tuple(r[k] for k in KEY): r for r in load(base_path)}
+    regressions = 0
+
+    print("%-12s %-28s %4s %-9s %12s %12s %8s %10s" %
+          ("impl", "policy", "thr", "mix", "base ops/s", "ops/s", "delta",
+           "del p99"))
+    for r in load(new_path):
+        k = tuple(r[c] for c in KEY)
+        if k not in base:
+            print("%-12s %-28s %4s %-9s %12s %12.0f %8s" %
+                  (k + ("-", value(r, "ops_per_sec"), "new")))
+            continue
+        b = base.pop(k)
+        d = delta(value(b, "ops_per_sec"), value(r, "ops_per_sec"))
+        lat = delta(value(b, "delete_p99"), value(r, "delete_p99"))
+        bad = d is not None and d < -threshold
+        regressions += bad
+        print("%-12s %-28s %4s %-9s %12.0f %12.0f %+7.1f%% %10s%s" %
+              (k + (value(b, "ops_per_sec"), value(r, "ops_per_sec"),
+                    d or 0.0, "" if lat is None else "%+.1f%%" % lat,
+                    "  REGRESSION" if bad else "")))
+    for k in base:
+        print("%-12s %-28s %4s %-9s %12s" % (k + ("missing",)))
+
+    print("%d regressions above %.1f%%" % (regressions, threshold))
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    if len(sys.argv) == 4 and sys.argv[1] == "plot":
+        plot(sys.argv[2], sys.argv[3])
+    elif len(sys.argv) in (4, 5) and sys.argv[1] == "compare":
+        threshold = float(sys.argv[4]) if len(sys.argv) == 5 else 5.0
+        sys.exit(compare(sys.argv[2], sys.argv[3], threshold))
+    else:
+        sys.stderr.write("usage: statistic.py plot bench.csv outdir\n"
+                         "       statistic.py compare baseline.csv bench.csv "
+                         "[threshold]\n")
+        sys.exit(2)
@@ -19,25 +19,36 @@
 #define HP_MAX_THREADS 128
 #define HP_MAX_HPS 5 /* This is named 'K' in the HP paper */
 #define CLPAD (128 / sizeof(uintptr_t)) /* 128 / 8 = 16 */
-#define HP_THRESHOLD_R 0 /* This is named 'R' in the HP paper */
 
 /* Maximum number of retired objects per thread */
 #define HP_MAX_RETIRED (HP_MAX_THREADS * HP_MAX_HPS)
 
+#define RL_SLAB 64 /* retire nodes carved out of one slab */
+
 #define TID_UNKNOWN -1
 
-typedef struct {
+typedef struct retirelist {
     uintptr_t ptr;
     struct rbtree rbnode;
     bool mark;
+    struct retirelist *next; /* free list of the slab */
 } retirelist_t;
 
+/* The retire tree of a thread and the slab its nodes come from */
+typedef struct {
+    struct task_tree_root tree;
+    uintptr_t *snap; /* sorted hazard pointers, taken by a scan */
+    retirelist_t *free;
+    void **slabs;
+    int nslabs, capslabs;
+} retireset_t;
+
 typedef void(list_hp_deletefunc_t)(struct rbtree *);
 
 typedef struct list_hp {
     int max_hps;
     alignas(128) atomic_uintptr_t *hp[HP_MAX_THREADS];
-    alignas(128) struct task_tree_root *rl[HP_MAX_THREADS * CLPAD];
+    alignas(128) retireset_t *rl[HP_MAX_THREADS * CLPAD];
     list_hp_deletefunc_t *deletefunc;
 } list_hp_t;
 
@@ -74,7 +85,9 @@ list_hp_t *list_hp_new(size_t max_hps, list_hp_deletefunc_t *deletefunc)
         hp->rl[i * CLPAD] = calloc(1, sizeof(*hp->rl[0]));
         for (int j = 0; j < hp->max_hps; j++)
             atomic_init(&hp->hp[i][j], 0);
-        RB_ROOT_INIT(*(hp->rl[i * CLPAD]));
+        RB_ROOT_INIT(hp->rl[i * CLPAD]->tree);
+        hp->rl[i * CLPAD]->snap =
+            calloc(HP_MAX_THREADS * hp->max_hps, sizeof(uintptr_t));
     }
 
     return hp;
@@ -87,8 +100,12 @@ void list_hp_destroy(list_hp_t *hp)
 {
     for (int i = 0; i < HP_MAX_THREADS; i++) {
         free(hp->hp[i]);
-        struct task_tree_root *rl = hp->rl[i * CLPAD];
-        rbtree_clean(rl, hp->deletefunc);
+        retireset_t *rl = hp->rl[i * CLPAD];
+        rbtree_clean(&rl->tree, hp->deletefunc);
+        for (int j = 0; j < rl->nslabs; j++)
+            free(rl->slabs[j]);
+        free(rl->slabs);
+        free(rl->snap);
         free(rl);
     }
     free(hp);
@@ -122,6 +139,34 @@ uintptr_t list_hp_protect_release(list_hp_t *hp, int ihp, uintptr_t ptr)
     return ptr;
 }
 
+/* Take a retire node from the slab of the thread, growing it if empty */
+static inline retirelist_t *retire_node_alloc(retireset_t *rl)
+{
+    if (!rl->free) {
+        retirelist_t *slab = malloc(RL_SLAB * sizeof(*slab));
+        assert(slab);
+        if (rl->nslabs == rl->capslabs) {
+            rl->capslabs = rl->capslabs ? rl->capslabs * 2 : 16;
+            rl->slabs = realloc(rl->slabs, rl->capslabs * sizeof(rl->slabs[0]));
+            assert(rl->slabs);
+        }
+        rl->slabs[rl->nslabs++] = slab;
+        for (int i = RL_SLAB - 1; i >= 0; i--) {
+            slab[i].next = rl->free;
+            rl->free = &slab[i];
+        }
+    }
+    retirelist_t *node = rl->free;
+    rl->free = node->next;
+    return node;
+}
+
+static inline void retire_node_free(retireset_t *rl, retirelist_t *node)
+{
+    node->next = rl->free;
+    rl->free = node;
+}
+
 rb_cmp_insert_prototype(cmp_insert, a, b)
 {
     retirelist_t *node = container_of(a, retirelist_t, rbnode);
@@ -132,73 +177,76 @@ rb_cmp_insert_prototype(cmp_insert, a, b)
         return 0;
 }
 
-rb_cmp_search_prototype(cmp_search, node, data)
+static int __hp_ptr_cmp(const void *a, const void *b)
 {
-    retirelist_t *n = container_of(node, retirelist_t, rbnode);
-    uintptr_t ptr = atomic_load((atomic_uintptr_t *)data);
-    if (n->ptr == ptr)
-        return RB_EQUAL;
-    else if (n->ptr > ptr)
-        return RB_LEFT;
-    else
-        return RB_RIGHT;
+    uintptr_t x = *(const uintptr_t *)a, y = *(const uintptr_t *)b;
+    return (x > y) - (x < y);
 }
 
-struct rbtree *rbtree_search_mark_delete(struct task_tree_root *root, void *data, int (*cmp)(struct rbtree *, void *))
+/* Copy the non-null hazard pointers of every thread that ever ran into
+ * 'snap' and sort them. Returns how many there are.
+ */
+static inline int __hp_snapshot(list_hp_t *hp, uintptr_t *snap)
 {
-    struct rbtree *temp = root->head;
-    retirelist_t *node;
-    int ret = 0;
-
-    while (temp != &root->nil) {
-        ret = cmp(temp, data);
-        switch (ret) {
-            case RB_EQUAL:
-                goto done;
-            case RB_LEFT:
-                temp = temp->leftC;
-                break;
-            case RB_RIGHT:
-                temp = temp->rightC;
-                break;
-            case RB_EQUAL_BREAK:
-                goto out;
+    int nthreads = atomic_load(&tid_v_base), n = 0;
+    for (int itid = 0; itid < nthreads && itid < HP_MAX_THREADS; itid++) {
+        for (int ihp = 0; ihp < hp->max_hps; ihp++) {
+            uintptr_t ptr = atomic_load(&hp->hp[itid][ihp]);
+            if (ptr)
+                snap[n++] = ptr;
         }
     }
-out:
-    return NULL;
-
-done:
-    node = container_of(temp, retirelist_t, rbnode);
-    node->mark = true;
-    return temp;
+    qsort(snap, n, sizeof(snap[0]), __hp_ptr_cmp);
+    return n;
 }
 
-static inline void _rbtree_mark_clean(struct task_tree_root *root,
-                                 struct rbtree *node,
-                                 void (*freefunc)(struct rbtree *))
+/* Mark the retired objects that are protected. The tree and the snapshot
+ * are both sorted by ptr, so one merge walk over the two does it, in
+ * O(retired + hazards) instead of one tree lookup per hazard slot.
+ */
+static inline void rbtree_mark_merge(struct task_tree_root *root,
+                                     const uintptr_t *snap, int nsnap)
 {
-    if (node != &root->nil) {        
-        struct rbtree *left = node->leftC;
-        struct rbtree *right = node->rightC;
-        _rbtree_mark_clean(root, left, freefunc);
-        _rbtree_mark_clean(root, right, freefunc);
+    struct rbtree *node = rbtree_first(root);
+    int i = 0;
 
+    while (node && i < nsnap) {
         retirelist_t *n = container_of(node, retirelist_t, rbnode);
-        if (!n->mark) {
-            _rbtree_delete(root, node);
-            freefunc(node);
-            root->cnt--;
+        if (n->ptr < snap[i]) {
+            node = rbtree_successor(root, node);
+        } else if (n->ptr > snap[i]) {
+            i++;
         } else {
-            n->mark = false;
+            n->mark = true;
+            node = rbtree_successor(root, node);
         }
     }
 }
 
-static inline void rbtree_mark_clean(struct task_tree_root *root,
-                                void (*freefunc)(struct rbtree *))
+static int __retire_marked(struct rbtree *node, void *arg)
+{
+    retirelist_t *n = container_of(node, retirelist_t, rbnode);
+    (void)arg;
+    if (!n->mark)
+        return 0;
+    n->mark = false;
+    return 1;
+}
+
+static void __retire_free(struct rbtree *node, void *arg)
+{
+    list_hp_t *hp = arg;
+    hp->deletefunc(node);
+    retire_node_free(hp->rl[tid() * CLPAD],
+                     container_of(node, retirelist_t, rbnode));
+}
+
+/* Free the nodes that are not marked and rebuild the tree with the rest,
+ * in one pass and without rotations.
+ */
+static inline void rbtree_mark_clean(list_hp_t *hp, retireset_t *rl)
 {
-    _rbtree_mark_clean(root, root->head, freefunc);
+    (void)rbtree_delete_if(&rl->tree, __retire_marked, __retire_free, hp);
 }
 
 /* Retire an object that is no longer in use by any thread, calling
@@ -208,25 +256,20 @@ static inline void rbtree_mark_clean(struct task_tree_root *root,
  */
 void list_hp_retire(list_hp_t *hp, uintptr_t ptr)
 {
-    struct task_tree_root *rl = hp->rl[tid() * CLPAD];
+    retireset_t *rl = hp->rl[tid() * CLPAD];
 
-    retirelist_t *node = malloc(sizeof(retirelist_t));
+    retirelist_t *node = retire_node_alloc(rl);
     node->ptr = ptr;
     node->mark = false;
-    rbtree_insert(rl, &node->rbnode, cmp_insert);
-    assert(rl->cnt < HP_MAX_RETIRED);
+    rbtree_insert(&rl->tree, &node->rbnode, cmp_insert);
+    // every retire scans, so only the protected nodes are left over
+    assert(rl->tree.cnt < HP_MAX_RETIRED);
 
-    if (rl->cnt < HP_THRESHOLD_R)
-        return;
-
-    for (int itid = 0; itid < HP_MAX_THREADS; itid++) {
-        for (int ihp = hp->max_hps - 1; ihp >= 0; ihp--) {
-            rbtree_search_mark_delete(rl, &hp->hp[itid][ihp], cmp_search);
-        }
-    }
+    int nsnap = __hp_snapshot(hp, rl->snap);
+    rbtree_mark_merge(&rl->tree, rl->snap, nsnap);
 
 // delete
-    rbtree_mark_clean(rl, hp->deletefunc);
+    rbtree_mark_clean(hp, rl);
 }
 
 /*
@@ -236,10 +279,6 @@ void list_hp_retire(list_hp_t *hp, uintptr_t ptr)
 
 #include <pthread.h>
 
-#define N_ELEMENTS 128
-#define N_THREADS (32 /*NNN*/)
-#define MAX_THREADS 128
-
 static atomic_uint_fast32_t deletes = 0, inserts = 0;
 
 enum { HP_NEXT = 0, HP_CURR = 1, HP_PREV };
@@ -286,11 +325,11 @@ void list_node_destroy(list_node_t *node)
     (void)atomic_fetch_add(&deletes, 1);
 }
 
+/* The retire node itself goes back to the slab of the retire set */
 static void __list_node_delete(struct rbtree *node)
 {
     retirelist_t *n = container_of(node, retirelist_t, rbnode);
     list_node_destroy((list_node_t *) n->ptr);
-    free(n);
 }
 
 /*
@@ -461,84 +500,27 @@ void list_destroy(list_t *list)
 {
     assert(list);
     list_node_t *prev = (list_node_t *)atomic_load(&list->head);
-    list_node_t *node = (list_node_t *)atomic_load(&prev->next);
+    list_node_t *node = get_unmarked_node(atomic_load(&prev->next));
     while (node) {
         list_node_destroy(prev);
         prev = node;
-        node = (list_node_t *)atomic_load(&prev->next);
+        node = get_unmarked_node(atomic_load(&prev->next));
     }
     list_node_destroy(prev);
     list_hp_destroy(list->hp);
     free(list);
 }
 
-static uintptr_t elements[MAX_THREADS + 1][N_ELEMENTS];
-
-static void *insert_thread(void *arg)
-{
-    list_t *list = (list_t *)arg;
-
-    for (size_t i = 0; i < N_ELEMENTS; i++)
-        (void)list_insert(list, (uintptr_t)&elements[tid()][i]);
-
-    return NULL;
-}
-
-// odd
-static void *delete_thread(void *arg)
-{
-    list_t *list = (list_t *)arg;
-
-    for (size_t i = 0; i < N_ELEMENTS; i++)
-        (void)list_delete(list, (uintptr_t)&elements[tid()][i]);
+#define bench_list_t list_t
+#define bench_new list_new
+#define bench_destroy list_destroy
+#define bench_insert list_insert
+#define bench_delete list_delete
 
-    return NULL;
-}
+#include "bench.h"
 
-#include <time.h>
-
-#define time_diff(start, end)                                                  \
-    (end.tv_nsec - start.tv_nsec < 0 ?                                         \
-             (1000000000 + end.tv_nsec - start.tv_nsec) :                      \
-             (end.tv_nsec - start.tv_nsec))
-#define time_check(_FUNC_)                                                     \
-    do {                                                                       \
-        struct timespec time_start;                                            \
-        struct timespec time_end;                                              \
-        double during;                                                         \
-        clock_gettime(CLOCK_MONOTONIC, &time_start);                           \
-        _FUNC_;                                                                \
-        clock_gettime(CLOCK_MONOTONIC, &time_end);                             \
-        during = time_diff(time_start, time_end);                              \
-        printf("%f\n", during);                                                \
-    } while (0)
-
-static inline int test(void)
+int main(int argc, char *argv[])
 {
-    list_t *list = list_new();
-
-    pthread_t thr[N_THREADS];
-
-    for (size_t i = 0; i < N_THREADS; i++)
-        pthread_create(&thr[i], NULL, (i & 1) ? delete_thread : insert_thread,
-                       list);
-
-    for (size_t i = 0; i < N_THREADS; i++)
-        pthread_join(thr[i], NULL);
-
-    for (size_t i = 0; i < N_ELEMENTS; i++) {
-        for (size_t j = 0; j < tid_v_base; j++)
-            list_delete(list, (uintptr_t)&elements[j][i]);
-    }
-
-    list_destroy(list);
-
+    bench_main("vrb_list", argc, argv);
     return 0;
 }
-
-int main(void)
-{
-    time_check(test());
-    // test();
-    return 0;
-}
\ No newline at end of file
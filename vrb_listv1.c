@@ -19,24 +19,39 @@
 #define HP_MAX_THREADS 128
 #define HP_MAX_HPS 5 /* This is named 'K' in the HP paper */
 #define CLPAD (128 / sizeof(uintptr_t)) /* 128 / 8 = 16 */
-#define HP_THRESHOLD_R 0 /* This is named 'R' in the HP paper */
 
 /* Maximum number of retired objects per thread */
 #define HP_MAX_RETIRED (HP_MAX_THREADS * HP_MAX_HPS)
 
+#define RL_SLAB 64 /* retire nodes carved out of one slab */
+
 #define TID_UNKNOWN -1
 
-typedef struct {
+typedef struct retirelist {
     uintptr_t ptr;
     struct rbtree rbnode;
+    struct retirelist *next; /* free list of the slab */
 } retirelist_t;
 
+/* The retire tree of a thread and the slab its nodes come from. A scan
+ * moves the nodes that are still protected into the spare tree, and the
+ * two trees swap roles.
+ */
+typedef struct {
+    struct task_tree_root tree[2];
+    int cur;
+    struct rbtree **keep; /* the nodes a scan found protected */
+    retirelist_t *free;
+    void **slabs;
+    int nslabs, capslabs;
+} retireset_t;
+
 typedef void(list_hp_deletefunc_t)(struct rbtree *);
 
 typedef struct list_hp {
     int max_hps;
     alignas(128) atomic_uintptr_t *hp[HP_MAX_THREADS];
-    alignas(128) struct task_tree_root *rl[HP_MAX_THREADS * CLPAD];
+    alignas(128) retireset_t *rl[HP_MAX_THREADS * CLPAD];
     list_hp_deletefunc_t *deletefunc;
 } list_hp_t;
 
@@ -73,7 +88,10 @@ list_hp_t *list_hp_new(size_t max_hps, list_hp_deletefunc_t *deletefunc)
         hp->rl[i * CLPAD] = calloc(1, sizeof(*hp->rl[0]));
         for (int j = 0; j < hp->max_hps; j++)
             atomic_init(&hp->hp[i][j], 0);
-        RB_ROOT_INIT(*(hp->rl[i * CLPAD]));
+        RB_ROOT_INIT(hp->rl[i * CLPAD]->tree[0]);
+        RB_ROOT_INIT(hp->rl[i * CLPAD]->tree[1]);
+        hp->rl[i * CLPAD]->keep =
+            calloc(HP_MAX_THREADS * hp->max_hps, sizeof(struct rbtree *));
     }
 
     return hp;
@@ -86,8 +104,12 @@ void list_hp_destroy(list_hp_t *hp)
 {
     for (int i = 0; i < HP_MAX_THREADS; i++) {
         free(hp->hp[i]);
-        struct task_tree_root *rl = hp->rl[i * CLPAD];
-        rbtree_clean(rl, hp->deletefunc);
+        retireset_t *rl = hp->rl[i * CLPAD];
+        rbtree_clean(&rl->tree[rl->cur], hp->deletefunc);
+        for (int j = 0; j < rl->nslabs; j++)
+            free(rl->slabs[j]);
+        free(rl->slabs);
+        free(rl->keep);
         free(rl);
     }
     free(hp);
@@ -121,6 +143,43 @@ uintptr_t list_hp_protect_release(list_hp_t *hp, int ihp, uintptr_t ptr)
     return ptr;
 }
 
+/* Take a retire node from the slab of the thread, growing it if empty */
+static inline retirelist_t *retire_node_alloc(retireset_t *rl)
+{
+    if (!rl->free) {
+        retirelist_t *slab = malloc(RL_SLAB * sizeof(*slab));
+        assert(slab);
+        if (rl->nslabs == rl->capslabs) {
+            rl->capslabs = rl->capslabs ? rl->capslabs * 2 : 16;
+            rl->slabs = realloc(rl->slabs, rl->capslabs * sizeof(rl->slabs[0]));
+            assert(rl->slabs);
+        }
+        rl->slabs[rl->nslabs++] = slab;
+        for (int i = RL_SLAB - 1; i >= 0; i--) {
+            slab[i].next = rl->free;
+            rl->free = &slab[i];
+        }
+    }
+    retirelist_t *node = rl->free;
+    rl->free = node->next;
+    return node;
+}
+
+static inline void retire_node_free(retireset_t *rl, retirelist_t *node)
+{
+    node->next = rl->free;
+    rl->free = node;
+}
+
+static int __retire_cmp(const void *a, const void *b)
+{
+    retirelist_t *x = container_of(*(struct rbtree *const *)a, retirelist_t,
+                                   rbnode);
+    retirelist_t *y = container_of(*(struct rbtree *const *)b, retirelist_t,
+                                   rbnode);
+    return (x->ptr > y->ptr) - (x->ptr < y->ptr);
+}
+
 rb_cmp_insert_prototype(cmp_insert, a, b)
 {
     retirelist_t *node = container_of(a, retirelist_t, rbnode);
@@ -150,28 +209,39 @@ rb_cmp_search_prototype(cmp_search, node, data)
  */
 void list_hp_retire(list_hp_t *hp, uintptr_t ptr)
 {
-    struct task_tree_root *rl = hp->rl[tid() * CLPAD];
+    retireset_t *rl = hp->rl[tid() * CLPAD];
+    struct task_tree_root *old = &rl->tree[rl->cur];
+    struct task_tree_root *new = &rl->tree[rl->cur ^ 1];
 
-    retirelist_t *node = malloc(sizeof(retirelist_t));
+    retirelist_t *node = retire_node_alloc(rl);
     node->ptr = ptr;
-    rbtree_insert(rl, &node->rbnode, cmp_insert);
-    assert(rl->cnt < HP_MAX_RETIRED);
-
-    if (rl->cnt < HP_THRESHOLD_R)
-        return;
+    rbtree_insert(old, &node->rbnode, cmp_insert);
+    // every retire scans, so only the protected nodes are left over
+    assert(old->cnt < HP_MAX_RETIRED);
 
-
-    struct task_tree_root *new = malloc(sizeof(struct task_tree_root));
-    RB_ROOT_INIT(*new);
+    size_t nkeep = 0;
     for (int itid = 0; itid < HP_MAX_THREADS; itid++) {
-        for (int ihp = hp->max_hps - 1; ihp >= 0; ihp--) {
-            struct rbtree *tmp = rbtree_search(rl, &hp->hp[itid][ihp], cmp_search);
-            if (tmp != NULL)
-                rbtree_insert(new, tmp, cmp_insert);
+        // in increasing order, a node moves from HP_CURR to HP_PREV
+        for (int ihp = 0; ihp < hp->max_hps; ihp++) {
+            struct rbtree *tmp = rbtree_search(old, &hp->hp[itid][ihp], cmp_search);
+            if (tmp != NULL) {
+                // take it out of the old tree, a node can only be in one
+                // tree at a time and must not be found twice
+                _rbtree_delete(old, tmp);
+                old->cnt--;
+                rl->keep[nkeep++] = tmp;
+            }
         }
     }
-    rbtree_clean(rl, hp->deletefunc);
-    hp->rl[tid() * CLPAD] = new;
+    // build the new tree at once instead of inserting one node at a time
+    qsort(rl->keep, nkeep, sizeof(rl->keep[0]), __retire_cmp);
+    rbtree_build_sorted(new, rl->keep, nkeep);
+    struct rbtree *tmp;
+    while ((tmp = rbtree_drain_next(old))) {
+        hp->deletefunc(tmp);
+        retire_node_free(rl, container_of(tmp, retirelist_t, rbnode));
+    }
+    rl->cur ^= 1;
 }
 
 /*
@@ -181,10 +251,6 @@ void list_hp_retire(list_hp_t *hp, uintptr_t ptr)
 
 #include <pthread.h>
 
-#define N_ELEMENTS 128
-#define N_THREADS (32 /*NNN*/)
-#define MAX_THREADS 128
-
 static atomic_uint_fast32_t deletes = 0, inserts = 0;
 
 enum { HP_NEXT = 0, HP_CURR = 1, HP_PREV };
@@ -231,11 +297,11 @@ void list_node_destroy(list_node_t *node)
     (void)atomic_fetch_add(&deletes, 1);
 }
 
+/* The retire node itself goes back to the slab of the retire set */
 static void __list_node_delete(struct rbtree *node)
 {
     retirelist_t *n = container_of(node, retirelist_t, rbnode);
     list_node_destroy((list_node_t *) n->ptr);
-    free(n);
 }
 
 /*
@@ -406,84 +472,27 @@ void list_destroy(list_t *list)
 {
     assert(list);
     list_node_t *prev = (list_node_t *)atomic_load(&list->head);
-    list_node_t *node = (list_node_t *)atomic_load(&prev->next);
+    list_node_t *node = get_unmarked_node(atomic_load(&prev->next));
     while (node) {
         list_node_destroy(prev);
         prev = node;
-        node = (list_node_t *)atomic_load(&prev->next);
+        node = get_unmarked_node(atomic_load(&prev->next));
     }
     list_node_destroy(prev);
     list_hp_destroy(list->hp);
     free(list);
 }
 
-static uintptr_t elements[MAX_THREADS + 1][N_ELEMENTS];
-
-static void *insert_thread(void *arg)
-{
-    list_t *list = (list_t *)arg;
-
-    for (size_t i = 0; i < N_ELEMENTS; i++)
-        (void)list_insert(list, (uintptr_t)&elements[tid()][i]);
+#define bench_list_t list_t
+#define bench_new list_new
+#define bench_destroy list_destroy
+#define bench_insert list_insert
+#define bench_delete list_delete
 
-    return NULL;
-}
-
-// odd
-static void *delete_thread(void *arg)
-{
-    list_t *list = (list_t *)arg;
-
-    for (size_t i = 0; i < N_ELEMENTS; i++)
-        (void)list_delete(list, (uintptr_t)&elements[tid()][i]);
-
-    return NULL;
-}
+#include "bench.h"
 
-#include <time.h>
-
-#define time_diff(start, end)                                                  \
-    (end.tv_nsec - start.tv_nsec < 0 ?                                         \
-             (1000000000 + end.tv_nsec - start.tv_nsec) :                      \
-             (end.tv_nsec - start.tv_nsec))
-#define time_check(_FUNC_)                                                     \
-    do {                                                                       \
-        struct timespec time_start;                                            \
-        struct timespec time_end;                                              \
-        double during;                                                         \
-        clock_gettime(CLOCK_MONOTONIC, &time_start);                           \
-        _FUNC_;                                                                \
-        clock_gettime(CLOCK_MONOTONIC, &time_end);                             \
-        during = time_diff(time_start, time_end);                              \
-        printf("%f\n", during);                                                \
-    } while (0)
-
-static inline int test(void)
+int main(int argc, char *argv[])
 {
-    list_t *list = list_new();
-
-    pthread_t thr[N_THREADS];
-
-    for (size_t i = 0; i < N_THREADS; i++)
-        pthread_create(&thr[i], NULL, (i & 1) ? delete_thread : insert_thread,
-                       list);
-
-    for (size_t i = 0; i < N_THREADS; i++)
-        pthread_join(thr[i], NULL);
-
-    for (size_t i = 0; i < N_ELEMENTS; i++) {
-        for (size_t j = 0; j < tid_v_base; j++)
-            list_delete(list, (uintptr_t)&elements[j][i]);
-    }
-
-    list_destroy(list);
-
+    bench_main("vrb_listv1", argc, argv);
     return 0;
 }
-
-int main(void)
-{
-    // time_check(test());
-    test();
-    return 0;
-}
\ No newline at end of file